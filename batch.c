@@ -0,0 +1,331 @@
+
+#include <string.h>
+#include "checkers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86
+#endif
+
+/*
+ * Batch move counting
+ *
+ * Counts the moves of many boards at once for leaf heavy work (perft,
+ * expanding a search frontier).  The boards are passed as a structure
+ * of arrays, one array per bitboard, so that 8 (AVX2) or 16 (AVX-512)
+ * boards fill the lanes of one vector and the DOWN_NEIGHBOR/UP_NEIGHBOR
+ * shift and mask sequence runs on all of them together.
+ *
+ * Plain moves and single jumps are counted in the lanes, the same way
+ * as count_jumps() does.  A board where some jump can go on is counted
+ * again with count_moves(), since the jump sequences cannot be counted
+ * from the masks alone.
+ */
+
+typedef int (*batch_fn)(const bitboard *, const bitboard *, const bitboard *,
+			const bool, int, int *);
+
+static int batch_scalar(const bitboard *black, const bitboard *white,
+			const bitboard *king, const bool color, int n,
+			int *counts);
+#ifdef BATCH_X86
+static int batch_avx2(const bitboard *black, const bitboard *white,
+		      const bitboard *king, const bool color, int n,
+		      int *counts);
+static int batch_avx512(const bitboard *black, const bitboard *white,
+			const bitboard *king, const bool color, int n,
+			int *counts);
+#endif
+
+static const struct {
+  const char *name;
+  batch_fn fn;
+} batch_impls[] = {
+#ifdef BATCH_X86
+  { "avx512", batch_avx512 },
+  { "avx2", batch_avx2 },
+#endif
+  { "scalar", batch_scalar },
+};
+#define N_BATCH_IMPLS (int)(sizeof(batch_impls) / sizeof(batch_impls[0]))
+
+static int batch_impl = -1;   /* index into batch_impls, -1 until chosen */
+
+/* whether the cpu we run on can execute implementation i */
+static bool batch_supported(int i)
+{
+#ifdef BATCH_X86
+  if (batch_impls[i].fn == batch_avx512)
+    return __builtin_cpu_supports("avx512f") != 0 &&
+      __builtin_cpu_supports("avx512vpopcntdq") != 0;
+  if (batch_impls[i].fn == batch_avx2)
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+  return TRUE;
+}
+
+/**
+ * Selects the batch implementation by name ("avx512", "avx2" or
+ * "scalar"), or the fastest one the cpu supports if name is NULL.
+ *
+ * \return FALSE if the implementation is unknown or not supported
+ */
+bool batch_select(const char *name)
+{
+  int i;
+
+#ifdef BATCH_X86
+  __builtin_cpu_init();
+#endif
+
+  for (i = 0; i < N_BATCH_IMPLS; i++)
+    if ((name == NULL || !strcmp(name, batch_impls[i].name)) &&
+	batch_supported(i)) {
+      batch_impl = i;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/** Name of the batch implementation in use */
+const char *batch_name()
+{
+  if (batch_impl < 0)
+    batch_select(NULL);
+
+  return batch_impls[batch_impl].name;
+}
+
+/**
+ * Counts the moves color has on each of n boards, given as the arrays
+ * black[], white[] and king[].  counts[k] gets what count_moves() would
+ * return for board k.
+ *
+ * \return The total number of moves
+ */
+int batch_count_moves(const bitboard *black, const bitboard *white,
+		      const bitboard *king, const bool color, int n,
+		      int *counts)
+{
+  if (batch_impl < 0)
+    batch_select(NULL);
+
+  return batch_impls[batch_impl].fn(black, white, king, color, n, counts);
+}
+
+/* exact count of one board whose lane found a jump */
+static int batch_jumps(const bitboard *black, const bitboard *white,
+		       const bitboard *king, const bool color, int k)
+{
+  bitboard board[N_BOARDS];
+
+  board[BLACK] = black[k];
+  board[WHITE] = white[k];
+  board[KING] = king[k];
+
+  return count_moves(board, color);
+}
+
+static int batch_scalar(const bitboard *black, const bitboard *white,
+			const bitboard *king, const bool color, int n,
+			int *counts)
+{
+  bitboard board[N_BOARDS];
+  int k, total = 0;
+
+  for (k = 0; k < n; k++) {
+    board[BLACK] = black[k];
+    board[WHITE] = white[k];
+    board[KING] = king[k];
+
+    total += counts[k] = count_moves(board, color);
+  }
+
+  return total;
+}
+
+#ifdef BATCH_X86
+
+/*
+ * DOWN_NEIGHBOR(v, 0/1) and UP_NEIGHBOR(v, 0/1) for a vector of boards,
+ * written with the VAND/VOR/VSLL/VSRL operations that each
+ * implementation defines for its vector type.  The shifts must be
+ * constants, so each direction is spelled out.
+ */
+#define V_DOWN(v, s0, s1) \
+VOR(VAND(VSLL(VAND(v, hi), s0), lo), VAND(VSLL(VAND(v, lo), s1), hi))
+#define V_UP(v, s0, s1) \
+VOR(VAND(VSRL(VAND(v, hi), s0), lo), VAND(VSRL(VAND(v, lo), s1), hi))
+#define V_D0(v) V_DOWN(v, 3, 4)
+#define V_D1(v) V_DOWN(v, 4, 5)
+#define V_U0(v) V_UP(v, 4, 3)
+#define V_U1(v) V_UP(v, 5, 4)
+
+/*
+ * Same as count_jumps() for one jump direction F of the pieces movers:
+ * adds the jumps to jsum and their landing squares to any, and the
+ * squares where a jump could go on in directions E1..E3 to cont.  C1..C3
+ * say whether the piece has to be able to move down (dcap) or up (ucap)
+ * for that direction.
+ */
+#define V_JUMPS(F, movers, E1, C1, E2, C2, E3, C3)			\
+  land = VAND(F(VAND(F(movers), theirs)), empty);			\
+  king_land = F(F(kings));						\
+  dcap = VAND(land, color ? ones : king_land);				\
+  ucap = VAND(land, color ? king_land : ones);				\
+  cont = VOR(cont, VOR(VOR(E1(VAND(E1(C1), theirs)), E2(VAND(E2(C2), theirs))), \
+		       E3(VAND(E3(C3), theirs))));			\
+  jsum = VADD(jsum, VPOPCNT(land));					\
+  any = VOR(any, land)
+
+/*
+ * Move and jump counts of the boards b, w, kg.  Leaves the plain moves
+ * in sum, the single jumps in jsum, a nonzero lane in any if there is a
+ * jump, and a nonzero lane in cont if some jump is a multiple one.
+ */
+#define V_COUNT()							\
+  empty = VXOR(VOR(b, w), ones);					\
+  mine = color ? b : w;							\
+  theirs = color ? w : b;						\
+  kings = VAND(mine, kg);						\
+  up = VAND(mine, color ? kg : ones);					\
+  down = VAND(mine, color ? ones : kg);					\
+  sum = VADD(VADD(VPOPCNT(VAND(V_D0(down), empty)), VPOPCNT(VAND(V_D1(down), empty))), \
+	     VADD(VPOPCNT(VAND(V_U0(up), empty)), VPOPCNT(VAND(V_U1(up), empty)))); \
+  jsum = any = cont = zero;						\
+  V_JUMPS(V_D0, down, V_D0, dcap, V_D1, dcap, V_U1, ucap);		\
+  V_JUMPS(V_D1, down, V_D0, dcap, V_D1, dcap, V_U0, ucap);		\
+  V_JUMPS(V_U0, up, V_U0, ucap, V_U1, ucap, V_D1, dcap);		\
+  V_JUMPS(V_U1, up, V_U0, ucap, V_U1, ucap, V_D0, dcap);		\
+  cont = VAND(cont, empty)
+
+/* population count of each 32-bit lane, with a nibble lookup table */
+__attribute__((target("avx2")))
+static __m256i popcount_avx2(__m256i v)
+{
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+				       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i bytes;
+
+  bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, nibble)),
+			  _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi32(v, 4), nibble)));
+
+  /* add up the four bytes of each lane */
+  return _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, _mm256_set1_epi8(1)),
+			   _mm256_set1_epi16(1));
+}
+
+#define VAND _mm256_and_si256
+#define VOR _mm256_or_si256
+#define VXOR _mm256_xor_si256
+#define VSLL _mm256_slli_epi32
+#define VSRL _mm256_srli_epi32
+#define VADD _mm256_add_epi32
+#define VPOPCNT popcount_avx2
+
+__attribute__((target("avx2")))
+static int batch_avx2(const bitboard *black, const bitboard *white,
+		      const bitboard *king, const bool color, int n,
+		      int *counts)
+{
+  const __m256i hi = _mm256_set1_epi32(0xf0f0f0f0);
+  const __m256i lo = _mm256_set1_epi32(0x0f0f0f0f);
+  const __m256i ones = _mm256_set1_epi32(0xffffffff);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i b, w, kg, mine, theirs, kings, empty, up, down;
+  __m256i land, king_land, dcap, ucap, sum, jsum, any, cont, total_v = zero;
+  int k, lane, total = 0, multi;
+
+  for (k = 0; k + 8 <= n; k += 8) {
+    b = _mm256_loadu_si256((const __m256i *)(black + k));
+    w = _mm256_loadu_si256((const __m256i *)(white + k));
+    kg = _mm256_loadu_si256((const __m256i *)(king + k));
+
+    V_COUNT();
+
+    /* jumps are forced, so boards with one count those instead */
+    sum = _mm256_blendv_epi8(jsum, sum, _mm256_cmpeq_epi32(any, zero));
+    _mm256_storeu_si256((__m256i *)(counts + k), sum);
+    total_v = VADD(total_v, sum);
+
+    multi = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(cont, zero))) & 0xff;
+    for (lane = 0; multi; lane++, multi >>= 1)
+      if (multi & 1) {
+	total -= counts[k + lane];
+	total += counts[k + lane] = batch_jumps(black, white, king, color, k + lane);
+      }
+  }
+
+  /* add up the lanes of total_v */
+  total_v = VADD(total_v, _mm256_srli_si256(total_v, 8));
+  total_v = VADD(total_v, _mm256_srli_si256(total_v, 4));
+  total += _mm256_extract_epi32(total_v, 0) + _mm256_extract_epi32(total_v, 4);
+
+  return total + batch_scalar(black + k, white + k, king + k, color, n - k, counts + k);
+}
+
+#undef VAND
+#undef VOR
+#undef VXOR
+#undef VSLL
+#undef VSRL
+#undef VADD
+#undef VPOPCNT
+
+#define VAND _mm512_and_si512
+#define VOR _mm512_or_si512
+#define VXOR _mm512_xor_si512
+#define VSLL _mm512_slli_epi32
+#define VSRL _mm512_srli_epi32
+#define VADD _mm512_add_epi32
+#define VPOPCNT _mm512_popcnt_epi32
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int batch_avx512(const bitboard *black, const bitboard *white,
+			const bitboard *king, const bool color, int n,
+			int *counts)
+{
+  const __m512i hi = _mm512_set1_epi32(0xf0f0f0f0);
+  const __m512i lo = _mm512_set1_epi32(0x0f0f0f0f);
+  const __m512i ones = _mm512_set1_epi32(0xffffffff);
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i b, w, kg, mine, theirs, kings, empty, up, down;
+  __m512i land, king_land, dcap, ucap, sum, jsum, any, cont, total_v = zero;
+  int k, lane, total = 0, multi;
+
+  for (k = 0; k + 16 <= n; k += 16) {
+    b = _mm512_loadu_si512(black + k);
+    w = _mm512_loadu_si512(white + k);
+    kg = _mm512_loadu_si512(king + k);
+
+    V_COUNT();
+
+    /* jumps are forced, so boards with one count those instead */
+    sum = _mm512_mask_blend_epi32(_mm512_test_epi32_mask(any, any), sum, jsum);
+    _mm512_storeu_si512(counts + k, sum);
+    total_v = VADD(total_v, sum);
+
+    multi = _mm512_test_epi32_mask(cont, cont);
+    for (lane = 0; multi; lane++, multi >>= 1)
+      if (multi & 1) {
+	total -= counts[k + lane];
+	total += counts[k + lane] = batch_jumps(black, white, king, color, k + lane);
+      }
+  }
+
+  total += _mm512_reduce_add_epi32(total_v);
+
+  return total + batch_scalar(black + k, white + k, king + k, color, n - k, counts + k);
+}
+
+#undef VAND
+#undef VOR
+#undef VXOR
+#undef VSLL
+#undef VSRL
+#undef VADD
+#undef VPOPCNT
+
+#endif /* BATCH_X86 */
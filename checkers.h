@@ -1,8 +1,11 @@
 #ifndef _CHECKERS_H
 #define _CHECKERS_H
 
+#include <stdio.h>
+
 typedef char bool;
 typedef char int8;
+typedef short int16;
 
 /** 
  * Bitboard representation
@@ -69,6 +72,9 @@ static const bitboard king_bits[2] = { 0x0000000f, 0xf0000000 };
  */
 #define LAST_ONE(x) ((x) & -(x))
 
+/** Number of ones in x, i.e. the number of pieces on a bitboard */
+#define BIT_COUNT(x) __builtin_popcount(x)
+
 /**
  * Generate bitmasks that represent moving a piece down left/right or 
  * up left/right.  Done it such a way so that DOWN_NEIGHBOR(x, i) and
@@ -114,6 +120,121 @@ struct move {
 };
 #define MAX_MOVES 48
 
+/**
+ * A position in a binary position file (.pos), fixed size so that a
+ * whole file can be mapped into memory and used as an array.  The file
+ * starts with a struct pos_header; the numbers are in the byte order of
+ * the machine that wrote it.
+ */
+struct pos_record {
+  bitboard board[N_BOARDS];
+  int8 btm;         /* the color to move */
+  int8 labels;      /* POS_RESULT, POS_SCORE: which labels are set */
+  int16 result;     /* result of the game for black, in thousandths */
+  int score;        /* a score for black, e.g. from a search */
+};
+#define POS_RESULT 1
+#define POS_SCORE 2
+
+struct pos_header {
+  char magic[4];    /* POS_MAGIC */
+  int version;      /* POS_VERSION */
+  int record_size;  /* sizeof(struct pos_record) */
+};
+#define POS_MAGIC "CPOS"
+#define POS_VERSION 1
+
+/**
+ * A game journal: a struct journal_header with the starting position,
+ * then a struct journal_record for each move, appended as the game goes
+ * on.  A record is written with a single write(), so a crash loses at
+ * most the record being written; a torn last record is ignored.
+ */
+struct journal_header {
+  char magic[4];    /* JOURNAL_MAGIC */
+  int version;      /* JOURNAL_VERSION */
+  bitboard board[N_BOARDS];
+  int8 btm;         /* the color to move first */
+  float time_left;
+};
+#define JOURNAL_MAGIC "CJNL"
+#define JOURNAL_VERSION 1
+
+struct journal_record {
+  bitboard board[N_BOARDS];   /* the position after the move */
+  char move[32];              /* as trans_move_string() writes it */
+  int8 color;                 /* who moved */
+  int8 depth;                 /* depths the search completed, 0 if none */
+  int16 spare;
+  float time_left;            /* seconds the program has left */
+  int score;                  /* of the search, black positive */
+  int nodes;
+};
+
+/** An open journal; records are written every batch of them */
+#define JOURNAL_BATCH 16
+struct journal {
+  int fd;
+  bool sync;                  /* fsync() after each write */
+  int batch, n;
+  struct journal_record pending[JOURNAL_BATCH];
+};
+
+/**
+ * Limits of a search with mtdf_limited(), 0 for none.  Another thread
+ * stops the search by setting stop, and starts the clock of a pondering
+ * search by setting ponderhit.  info is called, if not NULL, after each
+ * completed depth with the value for the side to move, the nodes and
+ * the milliseconds used.
+ */
+struct search_limits {
+  int movetime;               /* milliseconds */
+  int depth;
+  int nodes;
+  bool ponder;
+  volatile bool stop, ponderhit;
+  void (*info)(int depth, int val, int nodes, int msecs, const struct move *best);
+};
+
+/**
+ * A game played through the line based protocol (see protocol.c): its
+ * position, the search go asked for and where the answers go.  The
+ * server (server.c) searches on a copy, so the position may change
+ * while it runs.
+ */
+struct session {
+  bitboard board[N_BOARDS];
+  bool btm;
+  struct search_limits limits;
+  bool infinite;              /* answer only after stop */
+  FILE *out;
+};
+
+/** A position file mapped by pos_open() */
+struct pos_file {
+  const struct pos_record *rec;
+  int n;
+  void *map;
+  long size;
+};
+
+/**
+ * Compact move used inside the search.  Only the squares that change
+ * are stored, so a move can be made and taken back on a single board
+ * with XOR (see make_move() and unmake_move()) instead of copying the
+ * whole board for every ply.  The full board of struct move is still
+ * used for input/output.
+ */
+struct delta {
+  bitboard captured;        /* squares of all pieces jumped */
+  unsigned char from, to;   /* square numbers (0-31) */
+  bool promote;             /* TRUE if a man is crowned on the to square */
+};
+
+/** Mask of square number n (0-31), and the number of a single-square mask */
+#define SQUARE(n) ((bitboard)1 << (n))
+#define SQUARE_NUM(x) __builtin_ctz(x)
+
 
 /** 
  * Hash keys for the transposition table 
@@ -124,7 +245,8 @@ struct hash_pos {
   bool has_best_move;
   int high_bound, low_bound;
   unsigned char high_depth, low_depth;
-  struct move best_move; 
+  struct delta best_move; 
+  bitboard check;           /* hash_check() of the rest, see search.c */
 };
 #define BLACK_HASH 0xdeadbeef
 #define HASH_KEY(board) (INT_HASH(board[WHITE]) ^ INT_HASH(board[BLACK]))
@@ -136,29 +258,171 @@ struct hash_pos {
 /** 20mb (roughly) transposition table */
 #define TRANS_TABLE_SIZE 500000 
 
+/**
+ * The terms of eval() that only depend on a few squares.  The search
+ * keeps them up to date move by move (see eval_acc_move()) instead of
+ * computing them again at every leaf.
+ */
+struct eval_acc {
+  int material;     /* material, black positive */
+  int safe;         /* safe men on the border, black positive */
+  int doghole;      /* dog holes, black positive */
+  int8 back[2];     /* bricks of each color left on its own back rank */
+};
+
+/** The terms of eval(), as eval_terms() gives them one by one */
+#define TERM_MATERIAL 0
+#define TERM_TRAPPED 1
+#define TERM_DOGHOLE 2
+#define TERM_SAFE 3
+#define TERM_RUNAWAY 4
+#define TERM_TURN 5
+#define TERM_BACKRANK 6
+#define TERM_KILLS 7
+#define TERM_KINGS 8
+#define N_TERMS 9
+
+/** 
+ * Cache of eval() results at the leaves, direct mapped by HASH_KEY.
+ * The number of entries can be set at compile time with
+ * -DEVAL_CACHE_SIZE=n, 0 turns the cache off.
+ */
+struct eval_pos {
+  bitboard board[N_BOARDS];
+  bool btm;
+  int val;
+  bitboard check;           /* eval_check() of the rest, see search.c */
+};
+#ifndef EVAL_CACHE_SIZE
+#define EVAL_CACHE_SIZE 65536
+#endif
+
+/**
+ * Cache of the runaway term of eval(), direct mapped by the HASH_KEY of
+ * the men alone.  An entry holds the term for its men with no kings on
+ * the board, and the fields where a king would change it; it is used
+ * as long as no king stands on one of them.  The number of entries can
+ * be set at compile time with -DMEN_CACHE_SIZE=n, 0 turns it off.
+ */
+struct men_pos {
+  bitboard men[2];
+  bitboard reach;
+  int val;
+};
+#ifndef MEN_CACHE_SIZE
+#define MEN_CACHE_SIZE 16384
+#endif
+
+/** Most tuples of the n-tuple evaluator, and most fields in one */
+#define NTUPLE_MAX 16
+#define NTUPLE_MAX_SIZE 10
+
 
 /*
  * Multipliers for eval function
+ *
+ * Built with -DTUNABLE they are read from struct weights instead, which
+ * read_weights() can load from a file at startup; the values here are
+ * then only its defaults.  make builds ./checkers_tunable so, and ./tune.
  */
 
-#define MAT_MAN 100
-#define MAT_KING 150
 #define MAT_VICTORY 1000000
-#define TRAPPED_KING 50
-#define DOG_HOLE 10
-#define SAFE_MAN 1
-#define BLACK_TO_MOVE 3
-#define RUNAWAY_MAN 50
-#define RUNAWAY_ROW 7
-#define BACK_3 4
-#define BACK_2 12
-#define BACK_1 18
-#define BACK_0 20
-#define POSS_KILL 30
-#define POSS_ALTKILL 2
-#define POSS_EXTRAKILL 80
-#define KILL_FACT_TURN 1
-#define KILL_FACT_NOTURN 0.5
+#define MAX_RUNAWAY 7    /* most moves a man needs to the king row */
+
+#define DEF_MAT_MAN 100
+#define DEF_MAT_KING 150
+#define DEF_TRAPPED_KING 50
+#define DEF_DOG_HOLE 10
+#define DEF_SAFE_MAN 1
+#define DEF_BLACK_TO_MOVE 3
+#define DEF_RUNAWAY_MAN 50
+#define DEF_RUNAWAY_ROW 7
+#define DEF_BACK_3 4
+#define DEF_BACK_2 12
+#define DEF_BACK_1 18
+#define DEF_BACK_0 20
+#define DEF_POSS_KILL 30
+#define DEF_POSS_ALTKILL 2
+#define DEF_POSS_EXTRAKILL 80
+#define DEF_KILL_FACT_TURN 1
+#define DEF_KILL_FACT_NOTURN 0.5
+#define DEF_KING_CENTER 3       /* kings-only endgames, see kings_value() */
+#define DEF_DOUBLE_CORNER 15
+#define DEF_KING_CHASE 4
+
+#ifdef TUNABLE
+
+struct weights {
+  int mat_man, mat_king, trapped_king, dog_hole, safe_man, black_to_move;
+  int runaway_man, runaway_row;
+  int back[5];          /* by bricks left on the back rank, 4 is always 0 */
+  int poss_kill, poss_altkill, poss_extrakill;
+  double kill_fact_turn, kill_fact_noturn;
+  int king_center, double_corner, king_chase;
+};
+extern struct weights weights;
+
+/* a weight by its name, one of i and d is set */
+struct weight_name {
+  char *name;
+  int *i;
+  double *d;
+};
+extern const struct weight_name weight_names[];
+
+#define MAT_MAN weights.mat_man
+#define MAT_KING weights.mat_king
+#define TRAPPED_KING weights.trapped_king
+#define DOG_HOLE weights.dog_hole
+#define SAFE_MAN weights.safe_man
+#define BLACK_TO_MOVE weights.black_to_move
+#define RUNAWAY_MAN weights.runaway_man
+#define RUNAWAY_ROW weights.runaway_row
+#define BACK_3 weights.back[3]
+#define BACK_2 weights.back[2]
+#define BACK_1 weights.back[1]
+#define BACK_0 weights.back[0]
+#define POSS_KILL weights.poss_kill
+#define POSS_ALTKILL weights.poss_altkill
+#define POSS_EXTRAKILL weights.poss_extrakill
+#define KILL_FACT_TURN weights.kill_fact_turn
+#define KILL_FACT_NOTURN weights.kill_fact_noturn
+#define KING_CENTER weights.king_center
+#define DOUBLE_CORNER weights.double_corner
+#define KING_CHASE weights.king_chase
+
+/* the men cache would keep runaway values of the old weights */
+#undef MEN_CACHE_SIZE
+#define MEN_CACHE_SIZE 0
+
+#else
+
+#define MAT_MAN DEF_MAT_MAN
+#define MAT_KING DEF_MAT_KING
+#define TRAPPED_KING DEF_TRAPPED_KING
+#define DOG_HOLE DEF_DOG_HOLE
+#define SAFE_MAN DEF_SAFE_MAN
+#define BLACK_TO_MOVE DEF_BLACK_TO_MOVE
+#define RUNAWAY_MAN DEF_RUNAWAY_MAN
+#define RUNAWAY_ROW DEF_RUNAWAY_ROW
+#define BACK_3 DEF_BACK_3
+#define BACK_2 DEF_BACK_2
+#define BACK_1 DEF_BACK_1
+#define BACK_0 DEF_BACK_0
+#define POSS_KILL DEF_POSS_KILL
+#define POSS_ALTKILL DEF_POSS_ALTKILL
+#define POSS_EXTRAKILL DEF_POSS_EXTRAKILL
+#define KILL_FACT_TURN DEF_KILL_FACT_TURN
+#define KILL_FACT_NOTURN DEF_KILL_FACT_NOTURN
+#define KING_CENTER DEF_KING_CENTER
+#define DOUBLE_CORNER DEF_DOUBLE_CORNER
+#define KING_CHASE DEF_KING_CHASE
+
+#endif
+
+/** The kill factors in fixed point, with KILL_FACT_BITS fraction bits */
+#define KILL_FACT_BITS 1
+#define KILL_FIX(f) ((int)((f) * (1 << KILL_FACT_BITS)))
 
 #define INFINITY 2000000
 
@@ -168,36 +432,129 @@ struct hash_pos {
 
 /* io.c */
 int read_wdp(bitboard *board, const char *filename, bool *color, double *time);
+char *parse_position(char *str, bitboard *board, bool *color);
+FILE *pos_create(const char *filename);
+bool pos_write(FILE *fd, const struct pos_record *rec);
+bool pos_open(const char *filename, struct pos_file *pf);
+void pos_close(struct pos_file *pf);
 void print_board(bitboard *board);
 void print_move_list(bitboard *board, bool color, struct move *move_list, int n);
 bool trans_string_move(bitboard *board, struct move *move, 
 		       char *move_str, bool color);
 void trans_move_string(bitboard *board, struct move *move, 
 		       char *move_str, bool color);
-int trans_move_string_recur(bitboard diff, bitboard *pos);
+int trans_move_string_recur(bitboard diff, bitboard to, bitboard empty,
+			    bitboard *pos, int n);
 int valid_move_input(const char *input);
 int write_log(const bitboard *board, char move_list[][128], 
 	      const char *filename, int moves, bool *color, double time_left);
+bool journal_open(struct journal *j, const char *filename, const bitboard *board,
+		  bool btm, double time_left, int batch, bool sync);
+bool journal_append(struct journal *j, const struct journal_record *rec);
+bool journal_flush(struct journal *j);
+bool journal_close(struct journal *j);
 
 /* move.c */
 int generate_moves(bitboard *board, const bool color, struct move *move_list);
 int try_move(bitboard *board, const bool color, struct move *next_move);
 int try_capture(bitboard *board, bitboard mask, const bool color, struct move *next_move);
+int delta_move(bitboard *board, const bool color, struct delta *next_delta);
+int delta_capture(bitboard *board, const bool color, struct delta *next_delta);
+int count_jumps(bitboard *board, const bool color);
+int count_moves(bitboard *board, const bool color);
+bool has_capture(bitboard *board, const bool color);
+int generate_deltas_black(bitboard *board, struct delta *delta_list);
+int generate_deltas_white(bitboard *board, struct delta *delta_list);
+int count_moves_black(bitboard *board);
+int count_moves_white(bitboard *board);
+bitboard make_move(bitboard *board, const struct delta *delta, const bool color);
+void unmake_move(bitboard *board, const struct delta *delta, const bool color,
+		 bitboard cap_kings);
+bool find_move(bitboard *board, const bool color, const char *move_str,
+	       struct move *move);
+
+/* the generator of color's moves; inline, so the search calls it directly */
+static inline int generate_deltas(bitboard *board, const bool color,
+				  struct delta *delta_list)
+{
+  return color ? generate_deltas_black(board, delta_list) :
+    generate_deltas_white(board, delta_list);
+}
+
+/* batch.c */
+bool batch_select(const char *name);
+const char *batch_name();
+int batch_count_moves(const bitboard *black, const bitboard *white,
+		      const bitboard *king, const bool color, int n,
+		      int *counts);
+
+/* ntuple.c */
+extern bool ntuple_on;
+bool ntuple_select(const char *name);
+const char *ntuple_name();
+bool ntuple_load(const char *file);
+bool ntuple_save(const char *file);
+int ntuple_eval(bitboard *board, bool btm);
+int ntuple_index(bitboard *board, int *idx);
+int16 *ntuple_weights(int *size, int **tempo_weight);
+
+/* protocol.c */
+bool protocol_is(const char *line, const char *command);
+bool session_position(struct session *g, char *args);
+bool session_go(struct session *g, char *args, int movetime);
+void session_search(struct session *g);
+void session_tell(struct session *g, volatile bool *flag);
+int protocol_loop();
+
+/* server.c */
+int server_loop(const char *path, int n_workers);
 
 /* search.c */
 
-int nega_max(bitboard *board, int alpha, int beta, int depth, const bool color); 
+int alpha_beta(bitboard *board, const struct eval_acc *acc, int alpha, int beta,
+	       int depth, const bool color);
 void mtdf(bitboard *board, struct move *best_move, 
 	  const bool color, unsigned int time_s);
 void alarm_handler(int signal);
+void search_stats(int *depth, int *nodes, int *score);
+void mtdf_limited(bitboard *board, struct move *best_move, const bool color,
+		  const struct search_limits *limits);
+void search_tables(void);
+bool trans_probe(bitboard *board, const bool color, int hash_key,
+		 struct hash_pos *entry);
+void trans_store(int hash_key, struct hash_pos *entry);
+void search_free(void);
 
 /* eval.c */
 int eval(bitboard *board, bool btm);
+int eval_leaf(bitboard *board, bool btm, const struct eval_acc *acc);
+int eval_lazy(bitboard *board, bool btm, const struct eval_acc *acc,
+	      int alpha, int beta, bool *exact);
+int eval_terms(bitboard *board, bool btm, int *terms);
+extern const char *term_names[N_TERMS];
+void eval_free(void);
+void eval_acc_init(bitboard *board, struct eval_acc *acc);
+void eval_acc_move(const struct eval_acc *acc, bitboard *board,
+		   const struct delta *delta, const bool color,
+		   struct eval_acc *next);
+bool eval_acc_check(bitboard *board, const struct eval_acc *acc);
+bool weights_valid(void);
+bool read_weights(char *file);
+#ifdef TUNABLE
+void print_weights(void);
+#endif
 bitboard threatened(bitboard *board, int8 t_color);
 int fieldnumber(bitboard mask);
-int runaway(bitboard *board, int pos, bool color);
-int8 poss_kills(bitboard *board, bool color, int8 moves, bitboard pos,
-                int8 from_v, int8 from_h);
+bitboard threatened_black(bitboard *board);
+bitboard threatened_white(bitboard *board);
+bitboard free_kings_black(bitboard *board, bitboard enemy);
+bitboard free_kings_white(bitboard *board, bitboard enemy);
+bitboard runaway_black(bitboard *board, bitboard *runners);
+bitboard runaway_white(bitboard *board, bitboard *runners);
+bitboard runaway_reach_black(bitboard men);
+bitboard runaway_reach_white(bitboard men);
+bitboard kills_black(bitboard *board, int *longest);
+bitboard kills_white(bitboard *board, int *longest);
 
 
 #endif /* _CHECKERS_H */
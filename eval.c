@@ -1,8 +1,427 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "checkers.h"
 
 
+/** Men on pos. 4, 5, 12, 13, 20, 21, 28 or 29, safe on the border */
+#define SAFE_SQUARES 0x18181818
+
+#ifdef TUNABLE
+
+/** The weights of eval(), the compiled-in ones until read_weights() */
+struct weights weights = {
+  DEF_MAT_MAN, DEF_MAT_KING, DEF_TRAPPED_KING, DEF_DOG_HOLE, DEF_SAFE_MAN,
+  DEF_BLACK_TO_MOVE, DEF_RUNAWAY_MAN, DEF_RUNAWAY_ROW,
+  { DEF_BACK_0, DEF_BACK_1, DEF_BACK_2, DEF_BACK_3, 0 },
+  DEF_POSS_KILL, DEF_POSS_ALTKILL, DEF_POSS_EXTRAKILL,
+  DEF_KILL_FACT_TURN, DEF_KILL_FACT_NOTURN,
+  DEF_KING_CENTER, DEF_DOUBLE_CORNER, DEF_KING_CHASE
+};
+
+/** The weights by their names in a weights file */
+const struct weight_name weight_names[] = {
+  { "MAT_MAN", &weights.mat_man, NULL },
+  { "MAT_KING", &weights.mat_king, NULL },
+  { "TRAPPED_KING", &weights.trapped_king, NULL },
+  { "DOG_HOLE", &weights.dog_hole, NULL },
+  { "SAFE_MAN", &weights.safe_man, NULL },
+  { "BLACK_TO_MOVE", &weights.black_to_move, NULL },
+  { "RUNAWAY_MAN", &weights.runaway_man, NULL },
+  { "RUNAWAY_ROW", &weights.runaway_row, NULL },
+  { "BACK_0", &weights.back[0], NULL },
+  { "BACK_1", &weights.back[1], NULL },
+  { "BACK_2", &weights.back[2], NULL },
+  { "BACK_3", &weights.back[3], NULL },
+  { "POSS_KILL", &weights.poss_kill, NULL },
+  { "POSS_ALTKILL", &weights.poss_altkill, NULL },
+  { "POSS_EXTRAKILL", &weights.poss_extrakill, NULL },
+  { "KILL_FACT_TURN", NULL, &weights.kill_fact_turn },
+  { "KILL_FACT_NOTURN", NULL, &weights.kill_fact_noturn },
+  { "KING_CENTER", &weights.king_center, NULL },
+  { "DOUBLE_CORNER", &weights.double_corner, NULL },
+  { "KING_CHASE", &weights.king_chase, NULL },
+  { NULL, NULL, NULL }
+};
+
+/** Weak back rank values by the number of bricks left on it */
+#define back_rank weights.back
+
+#else
+
+/** Weak back rank values by the number of bricks left on it */
+static const int back_rank[5] = { BACK_0, BACK_1, BACK_2, BACK_3, 0 };
+
+#endif
+
+/* men structure cache, see struct men_pos; one per searching thread */
+#if MEN_CACHE_SIZE > 0
+static __thread struct men_pos *men_cache;
+#endif
+__thread int n_men_lookups, n_men_hits;
+
+/**
+ * Fields 1, 5, 28 and 32: the double corners, where the weaker side's
+ * kings hide in a kings-only endgame, and the only fields the dog holes
+ * look at.
+ */
+#define DOUBLE_CORNERS 0x88000011
+
+/** How close each field is to the center, from 0 on the border to 3 */
+static const int8 center[BOARD_SIZE] = {
+     0,  0,  0,  0,
+   0,  1,  1,  1,
+     1,  2,  2,  0,
+   0,  2,  3,  1,
+     1,  3,  2,  0,
+   0,  2,  2,  1,
+     1,  1,  1,  0,
+   0,  0,  0,  0
+};
+
+#define ROW(n) ((n) >> 2)
+#define COLUMN(n) ((((n) & 3) << 1) + !(ROW(n) & 1))
+
+/* dog hole value of the given black and white bricks */
+static int dog_holes(bitboard black, bitboard white)
+{
+  int doghole_val=0;
+
+  if ((white & 0x00000010) && (black & 0x00000001)) {
+    // White men on pos. 5 and black brick on pos. 1
+    #ifdef DEBUG_EVAL_DETAILS
+    printf("- White man in dog hole.\n");
+    #endif
+    doghole_val += DOG_HOLE;
+  } 
+  if ((black & 0x08000000) && (white & 0x80000000)) {
+    // Black men on pos. 28 and white brick on pos. 31
+    #ifdef DEBUG_EVAL_DETAILS
+    printf("- Black man in dog hole.\n");
+    #endif
+    doghole_val -= DOG_HOLE;
+  }
+
+  return doghole_val;
+}
+
+/**
+ * Computes the local terms of eval() (material, safe men, back ranks,
+ * dog holes) from scratch.
+ *
+ * \param board Board configuration
+ * \param acc Gets the terms
+ */
+void eval_acc_init(bitboard *board, struct eval_acc *acc)
+{
+  const bitboard men = ~board[KING];
+
+  /* Material */
+  acc->material = MAT_MAN * (BIT_COUNT(board[BLACK] & men) - BIT_COUNT(board[WHITE] & men)) +
+    MAT_KING * (BIT_COUNT(board[BLACK] & board[KING]) - BIT_COUNT(board[WHITE] & board[KING]));
+
+  /* Safe men on the right or left border are a plus */
+  acc->safe = SAFE_MAN * (BIT_COUNT(board[BLACK] & men & SAFE_SQUARES) -
+			  BIT_COUNT(board[WHITE] & men & SAFE_SQUARES));
+
+  /* Bricks left on the back ranks */
+  acc->back[WHITE] = BIT_COUNT(board[WHITE] & king_bits[BLACK]);
+  acc->back[BLACK] = BIT_COUNT(board[BLACK] & king_bits[WHITE]);
+
+  acc->doghole = dog_holes(board[BLACK], board[WHITE]);
+}
+
+/**
+ * Updates the local terms of eval() for a move, from the squares it
+ * changes.  Only the dog holes are looked at again, and only if the
+ * move touches one of their fields.
+ *
+ * \param acc The terms before the move
+ * \param board Board configuration before the move
+ * \param delta The move
+ * \param color The color making the move
+ * \param next Gets the terms after the move, may be acc itself
+ */
+void eval_acc_move(const struct eval_acc *acc, bitboard *board,
+		   const struct delta *delta, const bool color,
+		   struct eval_acc *next)
+{
+  const bitboard from = SQUARE(delta->from), to = SQUARE(delta->to);
+  const bitboard cap_men = delta->captured & ~board[KING];
+  const bitboard cap_kings = delta->captured & board[KING];
+  const int sign = color ? 1 : -1;
+
+  *next = *acc;
+
+  /* the moving brick, a king stays a king */
+  if (delta->promote) {
+    next->material += sign * (MAT_KING - MAT_MAN);
+    next->safe -= sign * SAFE_MAN * BIT_COUNT(from & SAFE_SQUARES);
+  }
+  else if (!(board[KING] & from))
+    next->safe += sign * SAFE_MAN * (BIT_COUNT(to & SAFE_SQUARES) - BIT_COUNT(from & SAFE_SQUARES));
+
+  /* the bricks taken */
+  next->material += sign * (MAT_MAN * BIT_COUNT(cap_men) + MAT_KING * BIT_COUNT(cap_kings));
+  next->safe += sign * SAFE_MAN * BIT_COUNT(cap_men & SAFE_SQUARES);
+
+  next->back[(int)color] += BIT_COUNT(to & king_bits[(int)!color]) - BIT_COUNT(from & king_bits[(int)!color]);
+  next->back[(int)!color] -= BIT_COUNT(delta->captured & king_bits[(int)color]);
+
+  if ((from | to | delta->captured) & DOUBLE_CORNERS) {
+    if (color)
+      next->doghole = dog_holes(board[BLACK] ^ from ^ to, board[WHITE] ^ delta->captured);
+    else
+      next->doghole = dog_holes(board[BLACK] ^ delta->captured, board[WHITE] ^ from ^ to);
+  }
+}
+
+/**
+ * Compares acc with the local terms computed from scratch.
+ *
+ * \return TRUE if they agree
+ */
+bool eval_acc_check(bitboard *board, const struct eval_acc *acc)
+{
+  struct eval_acc full;
+
+  eval_acc_init(board, &full);
+
+  return acc->material == full.material && acc->safe == full.safe &&
+    acc->doghole == full.doghole && acc->back[WHITE] == full.back[WHITE] &&
+    acc->back[BLACK] == full.back[BLACK];
+}
+
+/* the runaway term of eval() */
+static int runaway_value(bitboard *board)
+{
+  bitboard runners[2][MAX_RUNAWAY + 1];  /* runaway men by moves needed */
+  int val = 0, k;
+
+  runaway_black(board, runners[BLACK]);
+  runaway_white(board, runners[WHITE]);
+  for (k = 0; k <= MAX_RUNAWAY; k++)
+    val += (BIT_COUNT(runners[BLACK][k]) - BIT_COUNT(runners[WHITE][k])) *
+      (RUNAWAY_MAN - k * RUNAWAY_ROW);
+
+  return val;
+}
+
+/**
+ * The runaway term of eval(), looked up in the men structure cache
+ * first if there are kings.  The men of a king endgame stay where they
+ * are for many moves, so their runaway men only need to be found again
+ * when a king comes close to them.  The alarm may stop the search while
+ * an entry is written, so it is marked invalid until it is complete.
+ *
+ * \param board Board configuration
+ * \return The term, positive values are good for black
+ */
+static int cached_runaway(bitboard *board)
+{
+#if MEN_CACHE_SIZE > 0
+  bitboard men[N_BOARDS];
+  volatile struct men_pos *entry;
+  bitboard reach;
+  int val;
+
+  /* without kings the men move every ply, nothing to win here */
+  if (!board[KING])
+    return runaway_value(board);
+
+  if (men_cache == NULL)
+    men_cache = (struct men_pos *)calloc(MEN_CACHE_SIZE, sizeof(struct men_pos));
+
+  men[WHITE] = board[WHITE] & ~board[KING];
+  men[BLACK] = board[BLACK] & ~board[KING];
+  men[KING] = 0;
+  entry = &men_cache[HASH_KEY(men) % MEN_CACHE_SIZE];
+  n_men_lookups++;
+
+  if (entry->men[WHITE] != men[WHITE] || entry->men[BLACK] != men[BLACK]) {
+    reach = runaway_reach_black(men[BLACK]) | runaway_reach_white(men[WHITE]);
+    val = runaway_value(men);
+
+    /* no men board can be full, so the entry never matches half written */
+    entry->men[WHITE] = entry->men[BLACK] = 0xffffffff;
+    entry->reach = reach;
+    entry->val = val;
+    entry->men[WHITE] = men[WHITE];
+    entry->men[BLACK] = men[BLACK];
+  }
+  else if (!(board[KING] & entry->reach)) {
+    n_men_hits++;
+    return entry->val;
+  }
+
+  if (!(board[KING] & entry->reach))
+    return entry->val;
+#endif
+
+  return runaway_value(board);
+}
+
+/** Frees the men structure cache of the calling thread */
+void eval_free(void)
+{
+#if MEN_CACHE_SIZE > 0
+  free(men_cache);
+  men_cache = NULL;
+#endif
+}
+
+/* king moves from field a to field b on an empty board */
+static int king_distance(int a, int b)
+{
+  return MAX(abs(ROW(a) - ROW(b)), abs(COLUMN(a) - COLUMN(b)));
+}
+
+/**
+ * The term of eval() that replaces the positional ones when only kings
+ * are left.  The side with more kings wants them in the center and
+ * each one close to an enemy king, to drive the enemy kings into a
+ * corner and trap them there.  The other side wants its kings in the
+ * double corners, where they cannot be trapped, or else in the center.
+ *
+ * \param board Board configuration, only kings on it and both colors
+ * \return The term, black positive
+ */
+static int kings_value(bitboard *board)
+{
+  const int n_black = BIT_COUNT(board[BLACK]), n_white = BIT_COUNT(board[WHITE]);
+  const int strong = n_black > n_white ? BLACK : n_white > n_black ? WHITE : -1;
+  int val[2] = { 0, 0 }, color, sq, nearest;
+  bitboard k, e;
+
+  for (color = WHITE; color <= BLACK; color++)
+    for (k = board[color]; k; k &= k - 1) {
+      sq = SQUARE_NUM(k);
+
+      if (strong == !color && (LAST_ONE(k) & DOUBLE_CORNERS))
+	val[color] += DOUBLE_CORNER;
+      else
+	val[color] += KING_CENTER * center[sq];
+
+      if (color == strong) {
+	nearest = 7;
+	for (e = board[!color]; e; e &= e - 1)
+	  nearest = MIN(nearest, king_distance(sq, SQUARE_NUM(e)));
+	val[color] += KING_CHASE * (7 - nearest);
+      }
+    }
+
+  return val[BLACK] - val[WHITE];
+}
+
+/**
+ * The Trapped Kings term of eval(): the kings with no possible kill and
+ * no move to a field that is empty and not enemy-threatened.
+ *
+ * \param board Board configuration
+ * \param killers The bricks with possible kills, per color
+ * \return The term, black positive
+ */
+static int trapped_value(bitboard *board, const bitboard *killers)
+{
+  return TRAPPED_KING *
+    (BIT_COUNT(board[WHITE] & board[KING] & ~killers[WHITE] &
+	       ~free_kings_white(board, threatened_black(board))) -
+     BIT_COUNT(board[BLACK] & board[KING] & ~killers[BLACK] &
+	       ~free_kings_black(board, threatened_white(board))));
+}
+
+/**
+ * Tells whether the weights keep the bounds eval_lazy() relies on: no
+ * term may change sign, so all weights are at least 0, and a runaway
+ * man is worth something however far it has to go.
+ */
+bool weights_valid(void)
+{
+#ifdef TUNABLE
+  const struct weight_name *w;
+
+  for (w = weight_names; w->name; w++)
+    if (w->i ? *w->i < 0 : *w->d < 0)
+      return FALSE;
+#endif
+
+  return RUNAWAY_MAN >= MAX_RUNAWAY * RUNAWAY_ROW;
+}
+
+/**
+ * Loads eval() weights from a file with a line "NAME value" for each
+ * weight to change, NAME as in checkers.h.  Empty lines and lines
+ * starting with # are skipped.  Only possible when built with
+ * -DTUNABLE, otherwise the weights are compiled in.
+ *
+ * \param file The file name
+ * \return TRUE if all weights were read and are valid
+ */
+bool read_weights(char *file)
+{
+#ifdef TUNABLE
+  const struct weight_name *w;
+  char line[256], name[64];
+  double val;
+  int n = 0;
+  FILE *fd;
+
+  fd = fopen(file, "r");
+  if (fd == NULL) {
+    perror(file);
+    return FALSE;
+  }
+
+  while (fgets(line, sizeof(line), fd)) {
+    n++;
+    if (sscanf(line, " %63s", name) != 1 || name[0] == '#')
+      continue;
+
+    for (w = weight_names; w->name && strcmp(w->name, name); w++);
+    if (!w->name || sscanf(line, " %*s %lf", &val) != 1) {
+      fprintf(stderr, "%s:%d: bad weight line: %s", file, n, line);
+      fclose(fd);
+      return FALSE;
+    }
+
+    if (w->i)
+      *w->i = (int)val;
+    else
+      *w->d = val;
+  }
+
+  fclose(fd);
+
+  if (!weights_valid()) {
+    fprintf(stderr, "%s: weights must be at least 0 and RUNAWAY_MAN at least %d * RUNAWAY_ROW\n",
+	    file, MAX_RUNAWAY);
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  fprintf(stderr, "%s: weights can only be loaded by a build with -DTUNABLE,\n"
+	  "such as ./checkers_tunable\n", file);
+  return FALSE;
+#endif
+}
+
+#ifdef TUNABLE
+/**
+ * Prints the weights in the format read_weights() reads.
+ */
+void print_weights(void)
+{
+  const struct weight_name *w;
+
+  for (w = weight_names; w->name; w++)
+    if (w->i)
+      printf("%s %d\n", w->name, *w->i);
+    else
+      printf("%s %g\n", w->name, *w->d);
+}
+#endif
+
 /**
  * Evaluates an integer variable to a board position stating to whose favor
  * the board position is considered.
@@ -13,8 +432,114 @@
  */
 int eval(bitboard *board, bool btm)
 {
-  const bitboard empty = ~(board[WHITE] | board[BLACK]);
-  
+  struct eval_acc acc;
+
+  eval_acc_init(board, &acc);
+
+  return eval_leaf(board, btm, &acc);
+}
+
+/**
+ * eval() with the local terms taken from acc, which must be up to date
+ * for board.
+ *
+ * \param board Board configuration
+ * \param btm The color whose turn it is ("black to move")
+ * \param acc The local terms for board
+ * \return An integer. Positive values express an advantage for black and vv.
+ */
+int eval_leaf(bitboard *board, bool btm, const struct eval_acc *acc)
+{
+  bool exact;
+
+  return eval_lazy(board, btm, acc, -INFINITY, INFINITY, &exact);
+}
+
+/* 
+ * the most the kills term of color can be worth: every brick a killer
+ * and a row of kills over all the enemy bricks
+ */
+static int kills_bound(bitboard *board, int color, int kill_fact)
+{
+  const int mine = BIT_COUNT(board[color]), theirs = BIT_COUNT(board[!color]);
+
+  if (!mine || !theirs || !has_capture(board, color))
+    return 0;
+
+  return (kill_fact * (POSS_KILL + POSS_ALTKILL * (mine - 1) +
+		       POSS_EXTRAKILL * (theirs - 1))) >> KILL_FACT_BITS;
+}
+
+/*
+ * If the terms still missing, which can add at most high and take away
+ * at most low, cannot bring val inside (alpha, beta), sets *bound to
+ * the side of the window it stays on and returns TRUE
+ */
+static bool lazy_cut(int val, int low, int high, int alpha, int beta, int *bound)
+{
+  if (val + high <= alpha) {
+    *bound = val + high;
+    return TRUE;
+  }
+  if (val - low >= beta) {
+    *bound = val - low;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static int eval_window(bitboard *board, bool btm, const struct eval_acc *acc,
+		       int alpha, int beta, bool *exact, int *terms);
+
+/** names of the terms in the order of TERM_* */
+const char *term_names[N_TERMS] = {
+  "Material", "Trapped Kings", "Dog holes", "Safe men", "Runaway Checkers",
+  "Current Turn", "Back Rank", "Possible Kills", "Kings endgame"
+};
+
+/**
+ * eval() split into its terms, for profiling them.
+ *
+ * \param board Board configuration
+ * \param btm The color whose turn it is ("black to move")
+ * \param terms Gets the value of each term, indexed by TERM_*
+ * \return The sum of the terms, the same as eval()
+ */
+int eval_terms(bitboard *board, bool btm, int *terms)
+{
+  struct eval_acc acc;
+  bool exact;
+
+  eval_acc_init(board, &acc);
+
+  return eval_window(board, btm, &acc, -INFINITY, INFINITY, &exact, terms);
+}
+
+/**
+ * eval_leaf() for a search window.  The terms are computed cheapest
+ * first, and as soon as the ones still missing cannot bring the value
+ * back inside (alpha, beta) a bound is returned instead: at most alpha
+ * (and no less than the real value) or at least beta (and no more than
+ * it).  The kills, the most expensive term, are followed only for
+ * positions close to the window.
+ *
+ * \param board Board configuration
+ * \param btm The color whose turn it is ("black to move")
+ * \param acc The local terms for board
+ * \param alpha, beta The window, from black's point of view
+ * \param exact Set to FALSE if a bound was returned
+ * \return An integer. Positive values express an advantage for black and vv.
+ */
+int eval_lazy(bitboard *board, bool btm, const struct eval_acc *acc,
+	      int alpha, int beta, bool *exact)
+{
+  return eval_window(board, btm, acc, alpha, beta, exact, NULL);
+}
+
+/* eval_lazy(), and the terms to terms unless it is NULL */
+static int eval_window(bitboard *board, bool btm, const struct eval_acc *acc,
+		       int alpha, int beta, bool *exact, int *terms)
+{
   /* The factors whose sum will be returned */
   int material_val=0,   /* Material */
       trapped_val=0,    /* Trapped Kings */
@@ -23,230 +548,104 @@ int eval(bitboard *board, bool btm)
       runaway_val=0,    /* Runaway Men */
       turn_val=0,       /* Turn */
       backrank_val=0,   /* Weak Backrank */
-      kills_val=0;      /* Possible Kills */
-
-  bitboard to = board[BLACK]|board[WHITE];
-  bitboard next=0;      /* mask to the current brick */
-  bool color=0;         /* color of the current brick */
-  int color_bias=0;     /* -1 for white, 1 for black - useful for adding or
-                           subtracting values depending on the brick's color */
-
-	int i=0;							/* loop variable for the detection of next fields */
-	bitboard next_moves;	/* mask to the possible next moves of a king */
-	bitboard up;          /* mask to one upper neighboring field */
-	bitboard down;        /* mask to one lower neighboring field */
-  int8 currway=0;       /* runaway analysis for the current brick */
-  bitboard rest[N_BOARDS];
-
-  #define EXTRA 2
-  int8 curkills=0;      /* possible kills for current brick */
-  int8 moves=0;         /* direction in which current brick can move */
-  int8 kills[4];
-  kills[WHITE]=0;       /* total kill possibilities white bricks have */
-  kills[BLACK]=0;       /* total kill possibilities black bricks have */
-  kills[WHITE+EXTRA]=0; /* max. extra kills white bricks have */
-  kills[BLACK+EXTRA]=0; /* max. extra kills black bricks have */
-
-  /* one loop through all bricks is faster than many loops */
-  while (to) {
-    next = LAST_ONE(to);
-    
-    /* set values according to brick color */
-    if (next & board[BLACK]) {
-      color = BLACK;
-      color_bias = 1;
-      if (next & board[KING])
-        moves = UP + DOWN;
-      else
-        moves = DOWN;
-    } else {
-      color = WHITE;
-      color_bias = -1;
-      if (next & board[KING])
-        moves = UP + DOWN;
-      else
-        moves = UP;
-    }
+      kills_val=0,      /* Possible Kills */
+      kings_val=0;      /* Kings-only endgame */
+
+  int color=0;
+  bitboard killers[2];  /* bricks with possible kills, per color */
+  int kill_fact[2];     /* KILL_FACT_* in fixed point */
+  int longest[2];       /* most kills in a row per color */
+  int val, low, high, bound;
+
+#ifdef DEBUG_EVAL_ACC
+  if (!eval_acc_check(board, acc)) {
+    printf("EVAL: local terms out of date for position:\n");
+    print_board(board);
+    abort();
+  }
+#endif
 
-    /* Possible Kills */
-    curkills = poss_kills(board, color, moves, next, 0, 0);
-    if (curkills > 0) {
-      #ifdef DEBUG_EVAL_DETAILS
-      printf("- Possible kills for field %d: %d\n", fieldnumber(next), curkills);
-      #endif
-      kills[(int)color]++;
-      if (curkills-1 > kills[color + EXTRA]) kills[color + EXTRA] = curkills-1;
-    }
+  *exact = FALSE;
 
-    if (next & board[KING]) {
-
-      /* Material */
-      material_val += color_bias * MAT_KING;
-      
-      /* Trapped Kings */
-      /* Compute a mask with possible next moves for the king first */
-			next_moves = 0;
-			for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
-				/* Compute neighbor possitions */
-				down = DOWN_NEIGHBOR(next, i);
-  			up = UP_NEIGHBOR(next, i);
-      		
-   			/* If the neighboring field is empty or occupied by an enemy
-   				 which can be killed add the appropriate target field      */
-			  if (down & empty) {
-			 		next_moves |= down;
-		 		} else {
-		 		  if ((down & board[ENEMY(color)]) && (DOWN_NEIGHBOR(down, i) & empty))
-		 		  	next_moves |= DOWN_NEIGHBOR(down, i);
-		    }
-			  if (up & empty) {
-			 		next_moves |= up;
-		 		} else {
-		 		  if ((up & board[ENEMY(color)]) && (UP_NEIGHBOR(up, i) & empty))
-		 		  	next_moves |= UP_NEIGHBOR(up, i);
-		    }
-	    }
-         
-      /* In order *not* to be trapped there must exist a possible kill or
-      	 one of the poss. moves is either empty or not enemy-threatened   */
-		  if ((curkills == 0) &&
-          !(next_moves &
-            empty & ~(threatened(board, T_ENEMY(T_COLOR(color))) ) )) {
-  
-          #ifdef DEBUG_EVAL_DETAILS
-          printf("- Trapped king on position %d\n", fieldnumber(next));
-          #endif
-        trapped_val -= color_bias * TRAPPED_KING;
-      }
+  material_val = acc->material;
+  safe_val = acc->safe;
+  doghole_val = acc->doghole;
 
-    } else {
-
-      /* Material */
-      material_val += color_bias * MAT_MAN;
-      
-      /* Safe men on the right or left border are a plus */
-      if (next & 0x18181818) { // Men on pos. 4, 5, 12, 13, 20, 21, 28 or 29
-        #ifdef DEBUG_EVAL_DETAILS
-          printf("- Safe man on position %d\n", fieldnumber(next));
-        #endif
-        safe_val += color_bias * SAFE_MAN;
-      }
-      
-      /* Runaway Checkers */
-      /* The runaway function needs the board without the current man in order
-         to avoid a wrong result in certain situations */
-      rest[BLACK] = board[BLACK] & ~next;
-      rest[WHITE] = board[WHITE] & ~next;
-      rest[KING] = board[KING] & ~next;
-      
-      currway = runaway(rest, next, color);
-      rest[WHITE] = board[WHITE] & ~next;
-      rest[BLACK] = board[BLACK] & ~next;
-      rest[KING] = board[KING] & ~next;
-
-      currway = runaway(rest, next, color);
-      if (currway > -1) {
-        #ifdef DEBUG_EVAL_DETAILS
-        printf("- Man on field %d can become king within %d moves.\n",
-               fieldnumber(next), currway);
-        #endif 
-        runaway_val += color_bias * (RUNAWAY_MAN - currway * RUNAWAY_ROW);
-      }
-
-    }
-
-    to ^= next;
-  }
-  
   /* Check for victory */
   if (board[WHITE] == 0) material_val += MAT_VICTORY;
   if (board[BLACK] == 0) material_val -= MAT_VICTORY;
 
   /* Whose turn is it? */
-  float kill_fact[2];
   if (btm) {
-    turn_val += 3;
-    kill_fact[BLACK] = KILL_FACT_TURN;
-    kill_fact[WHITE] = KILL_FACT_NOTURN;
+    turn_val += BLACK_TO_MOVE;
+    kill_fact[BLACK] = KILL_FIX(KILL_FACT_TURN);
+    kill_fact[WHITE] = KILL_FIX(KILL_FACT_NOTURN);
   } else {
-    turn_val -= 3;
-    kill_fact[BLACK] = KILL_FACT_NOTURN;
-    kill_fact[WHITE] = KILL_FACT_TURN;
-  }
-  
-  /* Compute possible kills values */
-  if ((kills[BLACK] > 0)) {
-    kills_val += kill_fact[BLACK] * POSS_KILL;
-    kills_val += kill_fact[BLACK] * POSS_ALTKILL * (kills[BLACK]-1);
-    kills_val += kill_fact[BLACK] * POSS_EXTRAKILL * kills[BLACK+EXTRA];
+    turn_val -= BLACK_TO_MOVE;
+    kill_fact[BLACK] = KILL_FIX(KILL_FACT_NOTURN);
+    kill_fact[WHITE] = KILL_FIX(KILL_FACT_TURN);
   }
-  if ((kills[WHITE] > 0)) {
-    kills_val -= kill_fact[WHITE] * POSS_KILL;
-    kills_val -= kill_fact[WHITE] * POSS_ALTKILL * (kills[WHITE]-1);
-    kills_val -= kill_fact[WHITE] * POSS_EXTRAKILL * kills[WHITE+EXTRA];
+
+  /* Only kings left: the positional terms are kings_value(), and a
+     jump is all of the kills that is worth following.  Trapping the
+     weaker side's kings is the point, so they still count          */
+  if (board[KING] == (board[BLACK] | board[WHITE]) && board[BLACK] && board[WHITE]) {
+    doghole_val = safe_val = 0;
+    kings_val = kings_value(board);
+    killers[BLACK] = killers[WHITE] = 0;
+    for (color = WHITE; color <= BLACK; color++)
+      if (has_capture(board, color)) {
+	killers[color] = color ? kills_black(board, &longest[BLACK]) :
+	  kills_white(board, &longest[WHITE]);
+	val = (kill_fact[color] * POSS_KILL) >> KILL_FACT_BITS;
+	kills_val += color ? val : -val;
+      }
+    trapped_val = trapped_value(board, killers);
+    goto done;
   }
 
   /* Check for weak back ranks */
-  int backbricks=0;  
-  to = board[WHITE] & king_bits[BLACK];
-  while (to) {
-    next = LAST_ONE(to);
-    backbricks++;
-    to ^= next;
-  }
-  switch(backbricks) {
-  case 0:
-    backrank_val += BACK_0;
-    break;
-  case 1:
-    backrank_val += BACK_1;
-    break;
-  case 2:
-    backrank_val += BACK_2;
-    break;
-  case 3:
-    backrank_val += BACK_3;
-    break;
-  }
-  backbricks=0;
-  to = board[BLACK] & king_bits[WHITE];
-  while (to) {
-    next = LAST_ONE(to);
-    backbricks++;
-    to ^= next;
-  }
-  switch(backbricks) {
-  case 0:
-    backrank_val -= BACK_0;
-    break;
-  case 1:
-    backrank_val -= BACK_1;
-    break;
-  case 2:
-    backrank_val -= BACK_2;
-    break;
-  case 3:
-    backrank_val -= BACK_3;
-    break;
-  }
-  
-  /* Dog Holes */
-  if ((board[WHITE] & 0x00000010) && (board[BLACK] & 0x00000001)) {
-    // White men on pos. 5 and black brick on pos. 1
-    #ifdef DEBUG_EVAL_DETAILS
-    printf("- White man in dog hole.\n");
-    #endif
-    doghole_val += DOG_HOLE;
-  } 
-  if ((board[BLACK] & 0x08000000) && (board[WHITE] & 0x80000000)) {
-    // Black men on pos. 28 and white brick on pos. 31
-    #ifdef DEBUG_EVAL_DETAILS
-    printf("- Black man in dog hole.\n");
-    #endif
-    doghole_val -= DOG_HOLE;
-  }
-  
+  backrank_val = back_rank[(int)acc->back[WHITE]] - back_rank[(int)acc->back[BLACK]];
+
+  val = material_val + doghole_val + safe_val + turn_val + backrank_val;
+
+  /* every man a runaway on the king row, every king trapped */
+  high = kills_bound(board, BLACK, kill_fact[BLACK]) +
+    RUNAWAY_MAN * BIT_COUNT(board[BLACK] & ~board[KING]) +
+    TRAPPED_KING * BIT_COUNT(board[WHITE] & board[KING]);
+  low = kills_bound(board, WHITE, kill_fact[WHITE]) +
+    RUNAWAY_MAN * BIT_COUNT(board[WHITE] & ~board[KING]) +
+    TRAPPED_KING * BIT_COUNT(board[BLACK] & board[KING]);
+  if (lazy_cut(val, low, high, alpha, beta, &bound))
+    return bound;
+
+  /* Runaway Checkers */
+  runaway_val = cached_runaway(board);
+  val += runaway_val;
+
+  high -= RUNAWAY_MAN * BIT_COUNT(board[BLACK] & ~board[KING]);
+  low -= RUNAWAY_MAN * BIT_COUNT(board[WHITE] & ~board[KING]);
+  if (lazy_cut(val, low, high, alpha, beta, &bound))
+    return bound;
+
+  /* Possible Kills */
+  killers[BLACK] = kills_black(board, &longest[BLACK]);
+  killers[WHITE] = kills_white(board, &longest[WHITE]);
+
+  /* Trapped Kings: no possible kill and no move to a field that is
+     empty and not enemy-threatened                                   */
+  trapped_val = trapped_value(board, killers);
+
+  /* Compute possible kills values */
+  for (color = WHITE; color <= BLACK; color++)
+    if (killers[color]) {
+      val = (kill_fact[color] * (POSS_KILL + POSS_ALTKILL * (BIT_COUNT(killers[color])-1) +
+				 POSS_EXTRAKILL * (longest[color]-1))) >> KILL_FACT_BITS;
+      kills_val += color ? val : -val;
+    }
+
   /* Output the parameters */
+ done:
   #ifdef DEBUG_EVAL
   printf("Material: %d\n", material_val);
   printf("Trapped Kings: %d\n", trapped_val);
@@ -255,15 +654,55 @@ int eval(bitboard *board, bool btm)
   printf("Runaway Checkers: %d\n", runaway_val);
   printf("Current Turn: %d\n", turn_val);
   printf("Back Rank: %d\n", backrank_val);
-  printf("Possible Kills: %d (B: %d poss., max. %d; W: %d poss., max. %d)\n",
-         kills_val, kills[BLACK], kills[BLACK+EXTRA]+1, kills[WHITE], kills[WHITE+EXTRA]+1);
+  printf("Possible Kills: %d\n", kills_val);
+  printf("Kings endgame: %d\n", kings_val);
   #endif
 
+  *exact = TRUE;
+
+  if (terms) {
+    terms[TERM_MATERIAL] = material_val;
+    terms[TERM_TRAPPED] = trapped_val;
+    terms[TERM_DOGHOLE] = doghole_val;
+    terms[TERM_SAFE] = safe_val;
+    terms[TERM_RUNAWAY] = runaway_val;
+    terms[TERM_TURN] = turn_val;
+    terms[TERM_BACKRANK] = backrank_val;
+    terms[TERM_KILLS] = kills_val;
+    terms[TERM_KINGS] = kings_val;
+  }
+
   return material_val + trapped_val + doghole_val + safe_val + runaway_val +
-         turn_val + backrank_val + kills_val;
+         turn_val + backrank_val + kills_val + kings_val;
 }
 
 
+/* one jump of a row of kills in kills_black/white() */
+struct kill_frame {
+  bitboard board[N_BOARDS];   /* without the brick and the pieces it took */
+  bitboard land[2 * N_DIRS];  /* jumps not yet tried (down, then up) */
+  bitboard pos;               /* field the brick stands on */
+  int best;                   /* most kills in a row found from pos so far */
+};
+
+/* the helpers for each color, see eval_color.h */
+#define COLOR BLACK
+#define CNAME(f) f ## _black
+#define ENAME(f) f ## _white
+#include "eval_color.h"
+#undef COLOR
+#undef CNAME
+#undef ENAME
+
+#define COLOR WHITE
+#define CNAME(f) f ## _white
+#define ENAME(f) f ## _black
+#include "eval_color.h"
+#undef COLOR
+#undef CNAME
+#undef ENAME
+
+
 /**
  * Computes a mask with those fields marked which are threatened by bricks
  * of a certain color.
@@ -276,195 +715,15 @@ int eval(bitboard *board, bool btm)
 
 bitboard threatened(bitboard *board, int8 t_color)
 {
-  const bitboard empty = ~(board[WHITE] | board[BLACK]);
-  
   bitboard retmask = 0; /* Mask to return */
-  
-  /* Check just bricks of the appropriate color */
-  bitboard to;
-  if (t_color & T_BLACK) to |= board[BLACK];
-  if (t_color & T_WHITE) to |= board[WHITE];
-  
-  bitboard next=0, down=0, up=0;
-  int i=0;
-
-  while (to) {
-    next = LAST_ONE(to);
-    
-    for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
-    
-      /* Determine neighbors */
-      down = DOWN_NEIGHBOR((next&board[BLACK]) | (next&board[WHITE]&board[KING]), i);
-      up = UP_NEIGHBOR((next&board[BLACK]&board[KING]) | (next&board[WHITE]), i);
-      
-      /* A field is considered "threatened" if it is occupied by a hostile
-         brick and the next field into the same direction is empty         */
-      if (((next & board[BLACK] && down & ~board[BLACK]) ||
-           (next & board[WHITE] && down & ~board[WHITE])) &&
-          (DOWN_NEIGHBOR(down, i) & empty))
-        retmask |= down;
-      if (((next & board[BLACK] && up & ~board[BLACK]) ||
-           (next & board[WHITE] && up & ~board[WHITE])) &&
-          (UP_NEIGHBOR(up, i) & empty))
-        retmask |= up;
-    }
-    
-    to ^= next;
-  }
-  
-  return retmask;
-}
-
-
-/**
- * Determines recursively the minimum of moves thorugh unthreatened fields
- * for a man needed to become a king.
- *
- * \param board Board configuration
- * \param pos The position of the brick to check
- * \param color The color of this brick (BLACK or WHITE)
- * 
- * \return The amount of moves for a man needed to become a king
- *          or -1 if there is no unthreatened path to the hostile back row.
- */
-
-int runaway(bitboard *board, int pos, bool color)
-{
-  const bitboard empty = ~(board[WHITE] | board[BLACK]);
 
-  /* In this function the variable next is *not* used for the current field */
+  if (t_color & T_BLACK) retmask |= threatened_black(board);
+  if (t_color & T_WHITE) retmask |= threatened_white(board);
 
-  bitboard next,     /* Neighboring field */
-           nextnext; /* Neighbor to a neighboring field into the same dir */
-  int8 currway=-1,   /* Runaway analysis for the current field */
-       minval=10;    /* Minimum runaway analysis of free neighboring fields */
-  int i=0;
-
-  /* Return 0 if hostile back row is reached */
-  if (pos & king_bits[(int)color]) return 0;
-  
-  for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
-  
-    /* Determine neighbors */
-    if (color == BLACK) {
-      next = DOWN_NEIGHBOR(pos, i);
-      nextnext = DOWN_NEIGHBOR(DOWN_NEIGHBOR(pos, i), i);
-    } else {
-      next = UP_NEIGHBOR(pos, i);
-      nextnext = UP_NEIGHBOR(UP_NEIGHBOR(pos, i), i);
-    }
-
-/*
-printf("*** Field %d: threatened by enemy %d=%d\n", \
-  fieldnumber(next),  T_ENEMY(T_COLOR(color)), threatened(board, T_ENEMY(T_COLOR(color))) & next);  
-printf("*** Field %d\n", \
-  fieldnumber(next));
-*/
-printf(""); /* Needed to work properly (Weired !!!) */ 
-
-    /* Check recursively if field is empty and unthreatened */
-    if (next & empty & ~(threatened(board, T_ENEMY(T_COLOR(color))) & next))
-      currway = runaway(board, next, color);
-
-    /* Determine minimum runaway value if there was a path
-       to the hostile home row found                       */
-    if ((currway > -1) && (currway < minval)) minval = currway;
-  }
-  
-  /* Return minimum value + 1 */
-  if (minval == 10) return -1; else return minval + 1;
+  return retmask;
 }
 
 
-/**
- * Determines recursively how many bricks a brick of a certain kind could kill
- * standing on a certain field.
- *
- * \param board Board configuration
- * \param color The color of the brick that is possibly a killer (BLACK or WHITE)
- * \param moves The directions this brick can move to (UP, DOWN or UP+DOWN)
- * \param pos The position on which on the brick is standing
- * \param from_v The vertical direction the brick is coming from (UP or DOWN)
- * \param from_h The horizontal direction the brick is coming from (0 or 1)
- * 
- * \return The number of enemies that can be killed in a row starting from pos
- */
-
-int8 poss_kills(bitboard *board, bool color, int8 moves, bitboard pos,
-               int8 from_v, int8 from_h)
-{
-  const bitboard empty = ~(board[WHITE] | board[BLACK]);
-  
-  /* In this function the variable next is *not* used for the current field */
-  
-  bitboard next,     /* Neighboring field */
-           nextnext; /* Neighbor to a neighboring field into the same dir */
-  bitboard newboard[N_BOARDS];
-  int8 morekills=0,  /* Amount of further kills possible from a position */
-       maxkills=0;   /* Maximum of possible kills from position pos */
-  int i=0;
-  
-  for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
-    
-    /* If the brick can move down and did not come from exact that direction */
-    if ((moves & DOWN) && !((from_v & DOWN) && (from_h & i))) {
-    
-      /* Determine neighboring fields */
-      next = DOWN_NEIGHBOR(pos, i);
-      nextnext = DOWN_NEIGHBOR(DOWN_NEIGHBOR(pos, i), i);
-      
-      /* Call poss_kills recursively if neighbor can be killed */
-      if ((next & board[ENEMY(color)]) && (nextnext & empty)) {
-        newboard[WHITE] = board[WHITE] & ~next & ~pos;
-        newboard[BLACK] = board[BLACK] & ~next & ~pos;
-        newboard[KING] = board[KING] & ~next & ~pos;
-        
-        morekills = poss_kills(newboard, color, moves, nextnext, UP, i);
-        
-        /* The amount of possible kills into one direction is determined by
-           further kills after the first on, or equals otherwise one if the
-           target field is not threatened by an enemy                       */
-        if (morekills > 0) {
-          if (1 + morekills > maxkills) maxkills = 1 + morekills;
-        } else {
-          if (nextnext & ~threatened(newboard, T_ENEMY(T_COLOR(color))))
-            if (1 > maxkills) maxkills = 1;
-        }
-      } 
-    }
-    
-    /* If the brick can move up and did not come from exact that direction */
-    if ((moves & UP) && !((from_v & UP) && (from_h & i))) {
-      
-      /* Determine neighboring fields */
-      next = UP_NEIGHBOR(pos, i);
-      nextnext = UP_NEIGHBOR(UP_NEIGHBOR(pos, i), i);
-      
-      /* Call poss_kills recursively if neighbor can be killed */
-      if ((next & board[ENEMY(color)]) && (nextnext & empty)) {
-        newboard[WHITE] = board[WHITE] & ~next & ~pos;
-        newboard[BLACK] = board[BLACK] & ~next & ~pos;
-        newboard[KING] = board[KING] & ~next & ~pos;
-        
-        morekills = poss_kills(newboard, color, moves, nextnext, DOWN, i);
-        
-        /* The amount of possible kills into one direction is determined by
-           further kills after the first on, or equals otherwise one if the
-           target field is not threatened by an enemy                       */
-        if (morekills > 0) {
-          if (1 + morekills > maxkills) maxkills = 1 + morekills;
-        } else {
-          if (nextnext & ~threatened(newboard, T_ENEMY(T_COLOR(color))))
-            if (1 > maxkills) maxkills = 1;
-        }
-      } 
-    }
-  }
-  
-  return maxkills;
-}
-
-    
 /**
  * Used for debugging output purposes only
  *
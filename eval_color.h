@@ -0,0 +1,229 @@
+
+/*
+ * Evaluation helpers for one color
+ *
+ * Included by eval.c once per color, with COLOR defined as BLACK or
+ * WHITE, CNAME(f) giving the name of f for that color (f ## _black)
+ * and ENAME(f) the name for the other color.  The enemy board, the
+ * direction a man runs to and the row it is crowned on are constants
+ * in each copy.
+ */
+
+#if COLOR == BLACK
+#define DOWN_MOVERS(b) ((b)[BLACK])
+#define UP_MOVERS(b) ((b)[BLACK] & (b)[KING])
+#define BACKWARD_NEIGHBOR(x, i) UP_NEIGHBOR(x, i)
+#define FORWARD_NEIGHBOR(x, i) DOWN_NEIGHBOR(x, i)
+#else
+#define DOWN_MOVERS(b) ((b)[WHITE] & (b)[KING])
+#define UP_MOVERS(b) ((b)[WHITE])
+#define BACKWARD_NEIGHBOR(x, i) DOWN_NEIGHBOR(x, i)
+#define FORWARD_NEIGHBOR(x, i) UP_NEIGHBOR(x, i)
+#endif
+#define MINE(b) ((b)[COLOR])
+#define THEIRS(b) ((b)[!COLOR])
+#define PROMOTE_ROW king_bits[COLOR]
+
+/**
+ * Computes a mask with those fields marked which are threatened by the
+ * bricks of COLOR, for all bricks at once: a field is threatened from
+ * one direction if a brick that may move that way stands next to it and
+ * the field behind it is empty.
+ *
+ * \param board Board configuration
+ * \return The mask
+ */
+bitboard CNAME(threatened)(bitboard *board)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+
+  bitboard retmask = 0; /* Mask to return */
+  int i=0;
+
+  for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
+    retmask |= DOWN_NEIGHBOR(DOWN_MOVERS(board), i) & UP_NEIGHBOR(empty, i);
+    retmask |= UP_NEIGHBOR(UP_MOVERS(board), i) & DOWN_NEIGHBOR(empty, i);
+  }
+
+  return retmask & ~MINE(board);
+}
+
+/**
+ * Marks the kings of COLOR that are not trapped by the fields enemy
+ * threatens: those with a step, or a jump over an enemy, to a field that
+ * is empty and not threatened.
+ */
+bitboard CNAME(free_kings)(bitboard *board, bitboard enemy)
+{
+  const bitboard safe = ~(board[WHITE] | board[BLACK]) & ~enemy;
+  const bitboard kings = MINE(board) & board[KING];
+  bitboard to = 0;
+  int i=0;
+
+  for (i = 0; i < N_DIRS; i++) {
+    to |= UP_NEIGHBOR(safe | (THEIRS(board) & UP_NEIGHBOR(safe, i)), i);
+    to |= DOWN_NEIGHBOR(safe | (THEIRS(board) & DOWN_NEIGHBOR(safe, i)), i);
+  }
+
+  return kings & to;
+}
+
+/**
+ * Finds the men of COLOR that can become a king through empty fields not
+ * threatened by the enemy, and how many moves they need, for all men at
+ * once.  The fields are flooded backwards from the king row one move at
+ * a time, so each man gets the length of its shortest path.
+ *
+ * A man leaves its field empty, so the enemy brick right in front of
+ * its first step could jump it there; that step does not count as safe
+ * even though the field is not threatened with the man still standing.
+ *
+ * \param board Board configuration
+ * \param runners runners[k] gets the men that need k moves (0 to MAX_RUNAWAY)
+ * \return All men that can run away
+ */
+bitboard CNAME(runaway)(bitboard *board, bitboard *runners)
+{
+  const bitboard open = ~(board[WHITE] | board[BLACK]) & ~ENAME(threatened)(board);
+  bitboard men = MINE(board) & ~board[KING];
+  bitboard level,       /* fields k-1 moves away from the king row */
+           reached,     /* fields less than k moves away */
+           all;
+  int k, i;
+
+  /* a man placed on the king row by hand counts as already there */
+  runners[0] = all = men & PROMOTE_ROW;
+  men &= ~all;
+  level = reached = open & PROMOTE_ROW;
+
+  for (k = 1; k <= MAX_RUNAWAY; k++) {
+    runners[k] = 0;
+    for (i = 0; i < N_DIRS; i++)
+      runners[k] |= BACKWARD_NEIGHBOR(level & ~BACKWARD_NEIGHBOR(THEIRS(board), i), i);
+    runners[k] &= men;
+    men &= ~runners[k];
+    all |= runners[k];
+
+    level = (BACKWARD_NEIGHBOR(level, 0) | BACKWARD_NEIGHBOR(level, 1)) & open & ~reached;
+    reached |= level;
+  }
+
+  return all;
+}
+
+/**
+ * Marks the fields that can change the result of CNAME(runaway)() for
+ * the men of COLOR: the fields a man runs over all lie ahead of it, and
+ * whether one of them is safe depends on the bricks next to it.  A king
+ * anywhere else leaves the runaway men as they are.
+ *
+ * \param men The men of COLOR
+ * \return The mask
+ */
+bitboard CNAME(runaway_reach)(bitboard men)
+{
+  bitboard ahead = men;
+  int k;
+
+  for (k = 0; k < MAX_RUNAWAY; k++)
+    ahead |= FORWARD_NEIGHBOR(ahead, 0) | FORWARD_NEIGHBOR(ahead, 1);
+
+  return ahead | UP_NEIGHBOR(ahead, 0) | UP_NEIGHBOR(ahead, 1) |
+    DOWN_NEIGHBOR(ahead, 0) | DOWN_NEIGHBOR(ahead, 1);
+}
+
+/* the jumps the brick of frame f can make from its field */
+static void CNAME(kill_targets)(struct kill_frame *f, bitboard down, bitboard up)
+{
+  const bitboard empty = ~(f->board[WHITE] | f->board[BLACK]);
+  int i;
+
+  for (i = 0; i < N_DIRS; i++) {
+    f->land[i] = DOWN_NEIGHBOR(DOWN_NEIGHBOR(f->pos & down, i) & THEIRS(f->board), i) & empty;
+    f->land[N_DIRS + i] = UP_NEIGHBOR(UP_NEIGHBOR(f->pos & up, i) & THEIRS(f->board), i) & empty;
+  }
+}
+
+/**
+ * Finds the bricks of COLOR with possible kills and the longest row of
+ * kills among them.  The bricks with a jump at all are found for all of
+ * them at once; only those are followed further, depth first with an
+ * explicit stack.  A row of kills counts as long as its jumps, if it
+ * can be continued with at least one kill, or else as one kill if the
+ * brick lands on a field the enemy does not threaten.
+ *
+ * \param board Board configuration
+ * \param longest Gets the most kills in a row, 0 if there are none
+ * \return The bricks that have possible kills
+ */
+bitboard CNAME(kills)(bitboard *board, int *longest)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+  struct kill_frame stack[BOARD_SIZE], *f, *child;
+  bitboard jumpers = 0, killers = 0, to, next, cap, down, up;
+  int sp, d, i, val;
+
+  for (i = 0; i < N_DIRS; i++) {
+    jumpers |= DOWN_MOVERS(board) & UP_NEIGHBOR(THEIRS(board) & UP_NEIGHBOR(empty, i), i);
+    jumpers |= UP_MOVERS(board) & DOWN_NEIGHBOR(THEIRS(board) & DOWN_NEIGHBOR(empty, i), i);
+  }
+
+  *longest = 0;
+  for (to = jumpers; to; to ^= next) {
+    next = LAST_ONE(to);
+    down = DOWN_MOVERS(board) & next ? 0xffffffff : 0;
+    up = UP_MOVERS(board) & next ? 0xffffffff : 0;
+
+    f = &stack[0];
+    COPY_BOARD(f->board, board);
+    f->pos = next;
+    f->best = 0;
+    CNAME(kill_targets)(f, down, up);
+
+    sp = 0;
+    for (;;) {
+      f = &stack[sp];
+
+      for (d = 0; d < 2 * N_DIRS && !f->land[d]; d++);
+      if (d == 2 * N_DIRS) {
+	if (sp == 0)
+	  break;
+
+	/* all jumps from here tried, the jump to here is worth this */
+	val = f->best > 0 ? 1 + f->best : !(f->pos & ENAME(threatened)(f->board));
+	if (val > stack[--sp].best)
+	  stack[sp].best = val;
+	continue;
+      }
+
+      i = d % N_DIRS;
+      cap = d < N_DIRS ? UP_NEIGHBOR(f->land[d], i) : DOWN_NEIGHBOR(f->land[d], i);
+
+      /* the brick is taken off the board, as well as the pieces it took */
+      child = &stack[sp + 1];
+      child->board[WHITE] = f->board[WHITE] & ~cap & ~f->pos;
+      child->board[BLACK] = f->board[BLACK] & ~cap & ~f->pos;
+      child->board[KING] = f->board[KING] & ~cap & ~f->pos;
+      child->pos = f->land[d];
+      child->best = 0;
+      f->land[d] = 0;
+      CNAME(kill_targets)(child, down, up);
+      sp++;
+    }
+
+    if (stack[0].best > 0) {
+      killers |= next;
+      *longest = MAX(*longest, stack[0].best);
+    }
+  }
+
+  return killers;
+}
+
+#undef DOWN_MOVERS
+#undef UP_MOVERS
+#undef BACKWARD_NEIGHBOR
+#undef FORWARD_NEIGHBOR
+#undef MINE
+#undef THEIRS
+#undef PROMOTE_ROW
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "checkers.h"
 
 int read_wdp(bitboard *board, const char *filename, bool *color, double *time)
@@ -58,6 +62,132 @@ int read_wdp(bitboard *board, const char *filename, bool *color, double *time)
   return (n == 1);
 }
 
+/**
+ * Reads a position from a string written as in a .wdp file: the 32
+ * fields (b, w, B, W or .) and then the color to move (b or w).
+ *
+ * \return Where the string goes on after the color, NULL if it does
+ *         not start with a position
+ */
+char *parse_position(char *str, bitboard *board, bool *color)
+{
+  int n = 0;
+
+  board[WHITE] = board[BLACK] = board[KING] = 0;
+
+  for (; *str && n < BOARD_SIZE; str++)
+    switch (*str) {
+    case 'B':
+      board[KING] |= 1<<n;
+    case 'b':
+      board[BLACK] |= 1<<n;
+      n++;
+      break;
+    case 'W':
+      board[KING] |= 1<<n;
+    case 'w':
+      board[WHITE] |= 1<<n;
+      n++;
+      break;
+    case '.':
+      n++;
+    }
+
+  while (*str == ' ' || *str == '\t')
+    str++;
+  if (n < BOARD_SIZE || (*str != 'b' && *str != 'w'))
+    return NULL;
+  *color = *str++ == 'b' ? BLACK : WHITE;
+
+  return str;
+}
+
+/**
+ * Creates a binary position file and writes its header; the records
+ * follow with pos_write() and the file is closed with fclose().
+ */
+FILE *pos_create(const char *filename)
+{
+  struct pos_header header = { POS_MAGIC, POS_VERSION, sizeof(struct pos_record) };
+  FILE *fd;
+
+  fd = fopen(filename, "wb");
+  if (fd == NULL) {
+    perror(filename);
+    return NULL;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, fd) != 1) {
+    perror(filename);
+    fclose(fd);
+    return NULL;
+  }
+
+  return fd;
+}
+
+bool pos_write(FILE *fd, const struct pos_record *rec)
+{
+  return fwrite(rec, sizeof(*rec), 1, fd) == 1;
+}
+
+/**
+ * Maps a binary position file into memory.  The records are then read
+ * straight from the mapping as pf->rec[0] to pf->rec[pf->n - 1], with
+ * nothing parsed or copied, until pos_close().
+ *
+ * \return FALSE if the file cannot be mapped or is no position file
+ */
+bool pos_open(const char *filename, struct pos_file *pf)
+{
+  const struct pos_header *header;
+  struct stat st;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror(filename);
+    return FALSE;
+  }
+  if (fstat(fd, &st) < 0) {
+    perror(filename);
+    close(fd);
+    return FALSE;
+  }
+
+  pf->size = st.st_size;
+  pf->map = pf->size >= (long)sizeof(*header) ?
+    mmap(NULL, pf->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (pf->map == MAP_FAILED) {
+    fprintf(stderr, "%s: cannot map the file\n", filename);
+    return FALSE;
+  }
+
+  header = (const struct pos_header *)pf->map;
+  if (memcmp(header->magic, POS_MAGIC, sizeof(header->magic)) ||
+      header->version != POS_VERSION ||
+      header->record_size != sizeof(struct pos_record)) {
+    fprintf(stderr, "%s: not a position file of this version\n", filename);
+    munmap(pf->map, pf->size);
+    return FALSE;
+  }
+
+  madvise(pf->map, pf->size, MADV_SEQUENTIAL);
+  pf->rec = (const struct pos_record *)(header + 1);
+  pf->n = (pf->size - sizeof(*header)) / sizeof(struct pos_record);
+
+  return TRUE;
+}
+
+void pos_close(struct pos_file *pf)
+{
+  munmap(pf->map, pf->size);
+  pf->map = NULL;
+  pf->rec = NULL;
+  pf->n = 0;
+}
+
 void print_board(bitboard *board)
 {
   int i, before = 1, mask, n_rows = 0;;
@@ -195,23 +325,41 @@ bool trans_string_move(bitboard *board, struct move *move,
    return TRUE;
 }
 
+/* a jump takes at most 12 pieces, so it lands on at most 12 fields */
+#define MAX_PATH 16
+
 void trans_move_string(bitboard *board, struct move *move, 
 		       char *move_str, bool color)
 {
-  bitboard pos[10];          /* from/to and intermediate positions */
-  int n_pos = 1, i, n;
-  bitboard from, to, diff;
+  bitboard pos[MAX_PATH];    /* from/to and intermediate positions */
+  int n_pos = 0, i, n;
+  bitboard from, to, diff, starts, empty;
 
   from = (board[(int)color] ^ move->board[(int)color]) & board[(int)color];
   to = (board[(int)color] ^ move->board[(int)color]) & move->board[(int)color];
   
   diff = board[!color] ^ move->board[!color];
 
-  pos[0] = from;
-  if (diff)
-    n_pos += trans_move_string_recur(diff, pos + 1) - 2;
-  pos[n_pos++] = to;
+  /* a king jumping round back to its field moves none of our pieces,
+     so the king the path fits is the one that moved */
+  starts = from ? from : board[(int)color] & board[KING];
+  while (starts && !n_pos) {
+    pos[0] = LAST_ONE(starts);
+    starts ^= pos[0];
+    if (!from)
+      to = pos[0];
+    if (!diff) {
+      pos[1] = to;
+      n_pos = 2;
+    }
+    else {
+      empty = ~(board[WHITE] | board[BLACK]) | pos[0];
+      n_pos = trans_move_string_recur(diff, to, empty, pos + 1, MAX_PATH - 1);
+    }
+  }
        		    
+  if (!n_pos)
+    *move_str = 0;
   for (i = 0; i < n_pos; i++) {
     n = 0;
     while (pos[i]) {
@@ -223,26 +371,35 @@ void trans_move_string(bitboard *board, struct move *move,
   }
 }
 
-int trans_move_string_recur(bitboard diff, bitboard *pos)
+/**
+ * Finds the fields a jump from pos[-1] lands on, taking the pieces diff
+ * and landing last on to, and writes them to pos, at most n of them.
+ * Returns one more than the number written, or 0 if there is no path.
+ */
+int trans_move_string_recur(bitboard diff, bitboard to, bitboard empty,
+			    bitboard *pos, int n)
 {
-  int i, n;
+  bitboard over;
+  int i, k;
 
   if (!diff)
-    return 1;
+    return *(pos - 1) == to;
+  if (!n)
+    return 0;
   
   // check down neighbors
   for (i = 0; i < N_DIRS; i++)
-    if (DOWN_NEIGHBOR(*(pos - 1), i) & diff) {
-      *pos = DOWN_NEIGHBOR(DOWN_NEIGHBOR(*(pos - 1), i), i);
-      if ((n = trans_move_string_recur(diff ^ DOWN_NEIGHBOR(*(pos - 1), i), pos + 1)))
-	return n + 1;
+    if ((over = DOWN_NEIGHBOR(*(pos - 1), i) & diff)) {
+      *pos = DOWN_NEIGHBOR(over, i) & empty;
+      if (*pos && (k = trans_move_string_recur(diff ^ over, to, empty, pos + 1, n - 1)))
+	return k + 1;
     }
 
   for (i = 0; i < N_DIRS; i++)
-    if (UP_NEIGHBOR(*(pos - 1), i) & diff) {
-      *pos = UP_NEIGHBOR(UP_NEIGHBOR(*(pos - 1), i), i);
-      if ((n = trans_move_string_recur(diff ^ UP_NEIGHBOR(*(pos - 1), i), pos + 1)))
-	return n + 1;
+    if ((over = UP_NEIGHBOR(*(pos - 1), i) & diff)) {
+      *pos = UP_NEIGHBOR(over, i) & empty;
+      if (*pos && (k = trans_move_string_recur(diff ^ over, to, empty, pos + 1, n - 1)))
+	return k + 1;
     }
 
   return 0;
@@ -306,7 +463,7 @@ int write_log(const bitboard *board, char move_list[][128],
 
   }
 
-  fprintf(fd, " %s ", (color ? "b" : "w"));
+  fprintf(fd, " %s ", (*color ? "b" : "w"));
 
   fprintf(fd, "%.2lf\n", time_left);
   
@@ -320,3 +477,79 @@ int write_log(const bitboard *board, char move_list[][128],
   return 1;
 
 }
+
+/**
+ * Creates a game journal starting from board, with btm to move first,
+ * and writes its header.  Records are kept until batch of them can be
+ * written at once; with batch 1 each one is written as it comes, so a
+ * crash loses at most one record.  With sync each write is followed by
+ * fsync().
+ *
+ * \return FALSE if the file cannot be created
+ */
+bool journal_open(struct journal *j, const char *filename, const bitboard *board,
+		  bool btm, double time_left, int batch, bool sync)
+{
+  struct journal_header header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+  header.version = JOURNAL_VERSION;
+  COPY_BOARD(header.board, board);
+  header.btm = btm;
+  header.time_left = time_left;
+
+  j->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (j->fd < 0) {
+    perror(filename);
+    return FALSE;
+  }
+  j->sync = sync;
+  j->batch = MIN(MAX(batch, 1), JOURNAL_BATCH);
+  j->n = 0;
+
+  if (write(j->fd, &header, sizeof(header)) != sizeof(header) ||
+      (sync && fsync(j->fd) < 0)) {
+    perror(filename);
+    close(j->fd);
+    j->fd = -1;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/** Writes the records kept so far, with a single write() */
+bool journal_flush(struct journal *j)
+{
+  const ssize_t size = j->n * sizeof(struct journal_record);
+
+  if (j->fd < 0)
+    return FALSE;
+  if (j->n == 0)
+    return TRUE;
+
+  j->n = 0;
+  if (write(j->fd, j->pending, size) != size)
+    return FALSE;
+
+  return !j->sync || fsync(j->fd) == 0;
+}
+
+bool journal_append(struct journal *j, const struct journal_record *rec)
+{
+  j->pending[j->n++] = *rec;
+
+  return j->n < j->batch || journal_flush(j);
+}
+
+bool journal_close(struct journal *j)
+{
+  bool ok = journal_flush(j);
+
+  if (j->fd >= 0 && close(j->fd) < 0)
+    ok = FALSE;
+  j->fd = -1;
+
+  return ok;
+}
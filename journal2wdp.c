@@ -0,0 +1,85 @@
+/* reader of game journals */
+
+/*
+ * Turns the journal ./checkers -l writes (see struct journal_header)
+ * into the final position as a .wdp file, followed by the moves as
+ * write_log() writes them, and prints a readable log of the game with
+ * the time left and what the search found for each move.  A record
+ * torn by a crash at the end of the journal is left out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checkers.h"
+
+#define MAX_GAME_MOVES 1000
+
+int main(int argc, char *argv[])
+{
+  static char move_list[MAX_GAME_MOVES][128];
+  struct journal_header header;
+  struct journal_record rec;
+  bitboard board[N_BOARDS];
+  bool btm;
+  double time_left;
+  size_t n_read;
+  int n = 0;
+  FILE *fd;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: ./journal2wdp journal-file [wdp-file]\n");
+    fprintf(stderr, "       Prints the game; with wdp-file also writes the final\n");
+    fprintf(stderr, "       position and the moves to it.\n");
+    return 1;
+  }
+
+  fd = fopen(argv[1], "rb");
+  if (fd == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  if (fread(&header, sizeof(header), 1, fd) != 1 ||
+      memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) ||
+      header.version != JOURNAL_VERSION) {
+    fprintf(stderr, "%s: not a game journal of this version\n", argv[1]);
+    fclose(fd);
+    return 1;
+  }
+
+  COPY_BOARD(board, header.board);
+  btm = header.btm;
+  time_left = header.time_left;
+
+  printf("Starting position, %s to move:\n", btm ? "black" : "white");
+  print_board(board);
+  printf("\n%4s %-5s %-24s %8s %6s %5s %10s\n",
+	 "", "side", "move", "time", "score", "depth", "nodes");
+
+  while ((n_read = fread(&rec, 1, sizeof(rec), fd)) == sizeof(rec)) {
+    if (n < MAX_GAME_MOVES)
+      strcpy(move_list[n], rec.move);
+    n++;
+    printf("%3d. %-5s %-24s %8.2f", n, rec.color ? "black" : "white",
+	   rec.move, rec.time_left);
+    if (rec.depth > 0)
+      printf(" %6d %5d %10d", rec.score, rec.depth, rec.nodes);
+    printf("\n");
+
+    COPY_BOARD(board, rec.board);
+    btm = !rec.color;
+    time_left = rec.time_left;
+  }
+  if (n_read > 0)
+    fprintf(stderr, "%s: last record torn, left out\n", argv[1]);
+  fclose(fd);
+
+  printf("\nFinal position, %s to move:\n", btm ? "black" : "white");
+  print_board(board);
+
+  if (argc == 3 && !write_log(board, move_list, argv[2], MIN(n, MAX_GAME_MOVES),
+			      &btm, time_left))
+    return 1;
+
+  return 0;
+}
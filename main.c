@@ -19,10 +19,12 @@
  
  
 /* function prototypes */
+void log_move(bool mover, const struct journal_record *stats);	///< Appends a move to the journal.
 void my_turn();								///< Takes the system's turn.
 bool okay();									///< Asks operator to verify new board.
 bool accept_draw();						///< Determines if the system accepts a draw offer.
 int opponent_turn();					///< Asks for the opponent's turn.
+void read_operator(char *line, int size);	///< Reads a line the operator typed.
 int my_pieces_left();					///< The number of pieces the system has left.
 int opponent_pieces_left();		///< The number of pieces the opponent has left.
 int pieces_left(bool color);	///< The number of pieces left for 'color'.
@@ -35,8 +37,11 @@ int moves = 0; 								//!< Moves made by the system
 int	total_moves = 0; 					//!< Total moves made by both players
 int last_forty = 40; 					//!< Counter for the last (limits time when down to one man)
 int	score = 0;								//!< The score of the most recent board
-char move_list[300][128];     //!< Keeps a list of all moves made during the game (if logging)
+char last_move[128];          //!< The last move made, as text
 char *logfile;	              //!< Points to the filename for the logfile
+struct journal journal;       //!< The journal of the game (if logging)
+struct journal_record my_stats;  //!< What the search found for the system's last move
+bool sync_log = FALSE;        //!< Whether to fsync() each journal record
 bool color;                   //!< Which side the system is playing as
 bool logging = FALSE;         //!< Whether or not we're logging this game
 
@@ -51,19 +56,79 @@ jmp_buf env;                  //!< Alarm-handling variable
 
 int main(int argc, char *argv[]) {
 
-  char w, *filename = "starts/initial.wdp";		//	initial board is the default 
-  struct move list_moves[MAX_MOVES];
-  bool c = BLACK;
-  int i;
+  char w[128], *filename = "starts/initial.wdp";		//	initial board is the default 
+  char *server_path = NULL;
+  bool c = BLACK, protocol_on = FALSE;
+  int i, n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+  /* the line based protocol for programs (see protocol.c) prints nothing else */
+  if (argc > 1 && strcmp(argv[1], "--protocol") == 0) {
+    protocol_on = TRUE;
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+  /* many games over a socket, see server.c */
+  else if (argc > 2 && strcmp(argv[1], "--server") == 0) {
+    protocol_on = TRUE;
+    server_path = argv[2];
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+    if (argc > 2 && strcmp(argv[1], "--workers") == 0) {
+      n_workers = atoi(argv[2]);
+      argv[2] = argv[0];
+      argv += 2;
+      argc -= 2;
+    }
+  }
 
-  printf("Rdgrd mit grdde - Checkers\n(c) 2004 Lunds Tekniska Hgskola\n\n");
+  if (!protocol_on)
+    printf("Rdgrd mit grdde - Checkers\n(c) 2004 Lunds Tekniska Hgskola\n\n");
 
 	
 	/* command-line options */
+  /* eval() weights to use instead of the compiled-in ones */
+  if (argc > 2 && strcmp(argv[1], "--weights") == 0) {
+    if (!read_weights(argv[2]))
+      return 1;
+    if (!protocol_on)
+      printf("Using eval weights from %s.\n", argv[2]);
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+  /* the n-tuple evaluator, with the default tables or those in a file */
+  if (argc > 1 && strncmp(argv[1], "--eval=ntuple", 13) == 0) {
+    if (argv[1][13] == ':' ? !ntuple_load(argv[1] + 14) : !ntuple_load(NULL))
+      return 1;
+    if (!protocol_on)
+      printf("Using the n-tuple evaluator (%s).\n", ntuple_name());
+    ntuple_on = TRUE;
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+  if (server_path)
+    return server_loop(server_path, MAX(n_workers, 1));
+  if (protocol_on)
+    return protocol_loop();
   if (argc > 1) {
     if (strcmp(argv[1], "--help") == 0) {
-      printf("Usage: ./checkers [-lt] [board-file] [log-file]\n");
-      printf("          -l  Log this game to specified file.\n");
+      printf("Usage: ./checkers [--protocol | --server socket [--workers n]]\n");
+      printf("                  [--weights file] [--eval=ntuple[:file]] [-lst] [board-file] [log-file]\n");
+      printf("          --protocol  Be driven by a program through lines of\n");
+      printf("                     commands, see protocol.c.\n");
+      printf("          --server  Play the games of all connections to the\n");
+      printf("                     Unix socket, see server.c; with n\n");
+      printf("                     searching threads (all cores).\n");
+      printf("          --weights  Load eval weights from file (only\n");
+      printf("                     ./checkers_tunable, built with -DTUNABLE).\n");
+      printf("          --eval=ntuple[:file]  Evaluate with n-tuple tables,\n");
+      printf("                     the default ones or those in file.\n");
+      printf("          -l  Log this game to specified file, a journal\n");
+      printf("              that ./journal2wdp turns into a .wdp file.\n");
+      printf("          -s  Sync the log to disk after every move\n");
       printf("          -t  Ignore time constraints\n");
       printf("       To specify a board path and a log path at the same\n");
       printf("       time, omit both -l and t.\n"); 
@@ -83,6 +148,8 @@ int main(int argc, char *argv[]) {
           return 0;
         }
       }
+      if (strstr(argv[1], "s") != NULL)
+        sync_log = TRUE;
       if (strstr(argv[1], "t") != NULL) {
         printf("Unlimited time.\n");
 				secs_left = (double)INFINITY;
@@ -107,27 +174,26 @@ int main(int argc, char *argv[]) {
   printf("\n");
 
 	/* operator selects which side the computer shall play as */
-  while (w != 'b' && w != 'w') {
+  do {
     printf("OPERATOR: Enter 'b' if system is black, 'w' if white. [b/w] ");
     fflush(stdout);
-    w = getc(stdin);
-  }
-  if (w == 'b')
+    read_operator(w, sizeof(w));
+  } while (w[0] != 'b' && w[0] != 'w');
+  if (w[0] == 'b')
     color = BLACK;
   else
     color = WHITE;
   
-  // consume extra token -- for some reason an extra character gets entered in 
-	//	the getc() operation above.
-  w = getc(stdin);
-  
-  
   // load initial board, ignores position by using the dummy variable c
   if (!read_wdp(board, filename, &c, &secs_left)) {
     fprintf(stderr, "Could not load board map!\n");
     return 0;
   } 
 
+  /* every move is appended to the journal as soon as it is made */
+  if (logging && !journal_open(&journal, logfile, board, c, secs_left, 1, sync_log))
+    return 0;
+
   /* set up handling of alarm signal */
   sigemptyset(&alarm_set);
   sigaddset(&alarm_set, SIGALRM);
@@ -153,13 +219,13 @@ int main(int argc, char *argv[]) {
     printf("\n\n%s's turn:\n\n", (color ? "Black" : "White"));
 		
 		// check to see if i can even make any moves, if no, i lose
-    if (generate_moves(board, (bool)color, list_moves) <= 0) {
+    if (count_moves(board, (bool)color) <= 0) {
       printf("\nI cannot make any moves!\n");
       printf("\nI lost the game.\n\n");
       break;
     }
 		// check to see if my opponent can make any moves, if not, i win
-    if (generate_moves(board, (bool)!color, list_moves) <= 0) {
+    if (count_moves(board, (bool)!color) <= 0) {
       printf("\nOpponent cannot make any moves!\n");
       printf("\nI won the game.\n\n");
       break;
@@ -180,7 +246,7 @@ int main(int argc, char *argv[]) {
 
 		// write to the log, if thats what we want to do
     if (logging)
-      write_log(board, move_list, logfile, total_moves, !&color, secs_left);
+      log_move(color, &my_stats);
     
 		// maybe we jumped the last piece? if so, we won
 		if (opponent_pieces_left() <= 0) {
@@ -198,7 +264,7 @@ int main(int argc, char *argv[]) {
 		printf("\n\n%s's turn:\n\n", (!color ? "Black" : "White"));
 		
 		// check to see if the opponent can make moves, if not system wins
-    if (generate_moves(board, (bool)!color, list_moves) <= 0) {
+    if (count_moves(board, (bool)!color) <= 0) {
       printf("\nOpponent cannot make any moves!\n");
       printf("\nI won the game.\n\n");
       break;
@@ -241,7 +307,7 @@ int main(int argc, char *argv[]) {
     
 		// write to the log, if thats what we want to do
     if (logging)
-      write_log(board, move_list, logfile, total_moves, &color, secs_left);
+      log_move(!color, NULL);
 
 		// opponents move could have taken my last piece. if so, i lost
     if (my_pieces_left() <= 0) {
@@ -253,6 +319,47 @@ int main(int argc, char *argv[]) {
 }
 
 
+/**
+ *	Appends the last move to the journal, with the board after it and
+ *	the time left, and for the system's moves what the search found.
+ *
+ *	\param mover The color that made the move
+ *	\param stats Score, depth and nodes of the search, NULL for none
+ */
+void log_move(bool mover, const struct journal_record *stats) {
+  struct journal_record rec;
+
+  memset(&rec, 0, sizeof(rec));
+  if (stats)
+    rec = *stats;
+  COPY_BOARD(rec.board, board);
+  strncpy(rec.move, last_move, sizeof(rec.move) - 1);
+  rec.move[sizeof(rec.move) - 1] = 0;
+  rec.color = mover;
+  rec.time_left = secs_left;
+  total_moves++;
+
+  if (!journal_append(&journal, &rec))
+    perror(logfile);
+}
+
+/**
+ *	Reads a line the operator typed, without its newline.  The game
+ *	ends when the input does.
+ *
+ *	\param line Where to put the line
+ *	\param size The size of line; longer lines are cut
+ */
+void read_operator(char *line, int size) {
+  if (fgets(line, size, stdin) == NULL) {
+    printf("\nEnd of input, the game is abandoned.\n");
+    if (logging)
+      journal_flush(&journal);
+    exit(0);
+  }
+  line[strcspn(line, "\r\n")] = 0;
+}
+
 /**
  *	Nags the operator until they enter either 'y' or 'n', signifying
  *	whether or not the position he entered earlier is correct.
@@ -261,18 +368,17 @@ int main(int argc, char *argv[]) {
  *          FALSE if the operator says no, and wants to change the move.
  */
 bool okay() {
-  char inpt[1];
+  char inpt[128];
 	
-  while((inpt[0] != 'y' && inpt[0] != 'n') || inpt[0] == 0) { 
+  while (1) { 
     printf("OPERATOR: Is the board correct? [y/n] ");
     fflush(stdout);
-    gets(inpt);
+    read_operator(inpt, sizeof(inpt));
     if (inpt[0] == 'y')
       return TRUE;
     if (inpt[0] == 'n')
       return FALSE;
   }
-  return FALSE;
 }
 
 /** 
@@ -290,10 +396,9 @@ int opponent_turn() {
 
   // if opponent went first, ask to get that move:
 
-  char ctrl = (int)NULL, inp[128], inpt[1];
+  char ctrl = 0, inp[128], inpt[128];
   struct move opp_move;
   int n = 0, from, to, diff;
-  struct move l_moves[MAX_MOVES];
   bool must_jump = FALSE, once = TRUE, nagflag;
 
 	// get the move string
@@ -301,7 +406,7 @@ int opponent_turn() {
     nagflag = TRUE;
     
     // checks to see if there are any 
-    n = try_capture(board, 0xffffffff, !(int)color, l_moves);
+    n = has_capture(board, !color) ? count_moves(board, !color) : 0;
       
     if (n > 0 && once) {
       printf("\nWarning: %s has %d possible jump%s.\n", (!color ? "Black" : "White"), 
@@ -313,10 +418,8 @@ int opponent_turn() {
     }    
     
     printf("OPERATOR: Opponent's move was: \n");
-    //fflush(stdout);
-    if (gets(inp) == NULL) {
-      ctrl = (int)NULL;
-		}
+    fflush(stdout);
+    read_operator(inp, sizeof(inp));
 
 		// if the keyword "draw" was entered, decide whether or not to accept it
     if (strcmp(inp, "draw") == 0) {
@@ -335,21 +438,20 @@ int opponent_turn() {
       
       if ((trans_string_move(board, &opp_move, inp, !color)) != FALSE) {
         
-        if (inp && sscanf(inp, "%d-%d", &from, &to) >= 2) {
+        if (sscanf(inp, "%d-%d", &from, &to) >= 2) {
           from--;to--; 
           
           diff = (from/4+1)-(to/4+1);
           if (must_jump && (diff > -2 && diff < 2)) {
             printf("\nWarning: This move will cause %s to lose!\n", (!color ? "Black" : "White"));
           
-            while((inpt[0] != 'y' && inpt[0] != 'n') || inpt[0] == 0) { 
+            while (1) { 
               printf("\nOPERATOR: Are you sure this is correct? [y/n] ");
               fflush(stdout);
-              gets(inpt);
+              read_operator(inpt, sizeof(inpt));
               if (inpt[0] == 'y')
                 return 4;
               if (inpt[0] == 'n') {
-                inpt[0] = (int)NULL;
                 nagflag = FALSE;
                 break;
               }
@@ -364,9 +466,8 @@ int opponent_turn() {
             board[BLACK] = opp_move.board[BLACK];
             board[KING] = opp_move.board[KING];
 
-            // if we're logging, enter this move into the move_list array
-            if (logging) 
-              strcpy(move_list[total_moves++], inp);
+            // remember the move for the log
+            strcpy(last_move, inp);
 			
             break;
           }
@@ -375,7 +476,7 @@ int opponent_turn() {
     }
     if (nagflag)
       printf("Invalid move entered!\n");
-    ctrl = (int)NULL;  
+    ctrl = 0;  
   }
   return 1;
 }
@@ -389,6 +490,7 @@ void my_turn() {
   clock_t t = 0;							// "reset" the clock each time  
   double dt;
   unsigned int use;						// how much time we get to use
+  int i;
   struct move best_move;			// stores the move decided upon
   char move_str[128],					// stores the textual representation of the move 
 			 *stand;	 							// the "standings" string
@@ -417,9 +519,10 @@ void my_turn() {
   board[WHITE] = best_move.board[WHITE];
   board[KING] = best_move.board[KING];
 
-	// log this move, if we want to
-  if (logging) 
-    strcpy(move_list[total_moves++], move_str);
+	// remember the move and what the search found for the log
+  strcpy(last_move, move_str);
+  search_stats(&i, &my_stats.nodes, &my_stats.score);
+  my_stats.depth = i;
 
 	// figure out some stuff to get the right time
   if (t != -1) {
@@ -482,12 +585,10 @@ bool accept_draw() {
 unsigned int how_much_time() {
 
   int r = 0, time, p = my_pieces_left(), t = opponent_pieces_left();  
-	struct move m_list[MAX_MOVES];
-	
 	// check to see how many moves are possible. if only one is possible, then
 	// allow as little time as possible for that move, since what happens after-
 	// wards doesn't matter if you only have one first move choice.
-	if (generate_moves(board, (bool)color, m_list) == 1)
+	if (count_moves(board, (bool)color) == 1)
 		return 1;
 	
   // if BLACK & Good score  or  WHITE & Good score, then give less time
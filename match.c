@@ -0,0 +1,497 @@
+/* match runner */
+
+/*
+ * Plays two engines against each other through the line based protocol
+ * (see protocol.c), several games at a time.  Each worker thread starts
+ * its own pair of engines and plays games one after the other, each
+ * opening twice with the colors swapped.  The openings are positions from
+ * .wdp files (starts/ by default) or text files with one position per
+ * line, written as wdp2pos reads them.
+ *
+ * A game is lost by the side that cannot move, answers with an illegal
+ * move or no move at all.  It is drawn after MAX_QUIET plies without a
+ * man moving or a capture, or after MAX_PLIES plies.
+ *
+ * The score of the first engine is tested with a sequential probability
+ * ratio test: Elo elo0 against elo1, with the error rates alpha and
+ * beta.  The match ends when the log likelihood ratio leaves its bounds,
+ * or after the number of games asked for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <glob.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#undef INFINITY         /* math.h has one too, checkers.h wins */
+#include "checkers.h"
+
+#define MAX_WORKERS 64
+#define MAX_PLIES 300
+#define MAX_QUIET 80
+#define MAX_ENGINE_ARGS 16
+
+/* an engine process, the pipes to it and what it wrote but was not read */
+struct engine {
+  pid_t pid;
+  FILE *in;
+  int out;
+  char buf[4096];
+  int len;
+};
+
+struct opening {
+  bitboard board[N_BOARDS];
+  bool btm;
+};
+
+static char *engine_cmd[2];
+static char go_cmd[64];
+static int answer_ms;                   /* longest wait for a bestmove */
+
+static struct opening *openings;
+static int n_openings;
+
+/* the match so far, under lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int next_game, n_games;
+static int wins, draws, losses;         /* of the first engine */
+static bool decided;
+static double elo0 = 0, elo1 = 5, alpha = 0.05, beta = 0.05;
+
+/* forks are serialized, so that no engine inherits another's pipes */
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool start_engine(struct engine *e, char *cmd)
+{
+  char buf[256], *argv[MAX_ENGINE_ARGS + 2], *p;
+  int to[2], from[2], argc = 0;
+
+  /* the program, --protocol, then its other arguments */
+  strncpy(buf, cmd, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for (p = strtok(buf, " \t"); p && argc < MAX_ENGINE_ARGS; p = strtok(NULL, " \t")) {
+    argv[argc++] = p;
+    if (argc == 1)
+      argv[argc++] = "--protocol";
+  }
+  argv[argc] = NULL;
+
+  pthread_mutex_lock(&spawn_lock);
+  if (pipe(to) < 0 || pipe(from) < 0) {
+    pthread_mutex_unlock(&spawn_lock);
+    perror("pipe");
+    return FALSE;
+  }
+  fcntl(to[1], F_SETFD, FD_CLOEXEC);
+  fcntl(from[0], F_SETFD, FD_CLOEXEC);
+
+  if ((e->pid = fork()) == 0) {
+    dup2(to[0], 0);
+    dup2(from[1], 1);
+    close(to[0]);
+    close(from[1]);
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+  close(to[0]);
+  close(from[1]);
+  pthread_mutex_unlock(&spawn_lock);
+
+  if (e->pid < 0) {
+    perror("fork");
+    close(to[1]);
+    close(from[0]);
+    return FALSE;
+  }
+  e->in = fdopen(to[1], "w");
+  e->out = from[0];
+  e->len = 0;
+
+  return TRUE;
+}
+
+static void stop_engine(struct engine *e)
+{
+  if (e->pid <= 0)
+    return;
+  fprintf(e->in, "quit\n");
+  fclose(e->in);
+  close(e->out);
+  waitpid(e->pid, NULL, 0);
+  e->pid = 0;
+  e->in = NULL;
+}
+
+/*
+ * An engine that answered wrongly is replaced before the next game.
+ *
+ * \return FALSE if it cannot be started again, it is stopped then
+ */
+static bool restart_engine(struct engine *e, char *cmd)
+{
+  kill(e->pid, SIGKILL);
+  stop_engine(e);
+
+  return start_engine(e, cmd);
+}
+
+/*
+ * Reads a line from the engine, waiting at most answer_ms for it.
+ *
+ * \return FALSE if the engine did not answer in time or is gone
+ */
+static bool read_line(struct engine *e, char *line, int size)
+{
+  struct pollfd p;
+  char *end;
+  int n;
+
+  p.fd = e->out;
+  p.events = POLLIN;
+  while ((end = memchr(e->buf, '\n', e->len)) == NULL) {
+    if (e->len == sizeof(e->buf))
+      e->len = 0;               /* no line is that long, drop it */
+    if (poll(&p, 1, answer_ms) <= 0 ||
+	(n = read(e->out, e->buf + e->len, sizeof(e->buf) - e->len)) <= 0)
+      return FALSE;
+    e->len += n;
+  }
+
+  n = end - e->buf + 1;
+  memcpy(line, e->buf, MIN(n, size - 1));
+  line[MIN(n, size - 1)] = 0;
+  memmove(e->buf, e->buf + n, e->len - n);
+  e->len -= n;
+
+  return TRUE;
+}
+
+/* writes the position as the 32 fields and the color to move */
+static void position_string(const bitboard *board, bool btm, char *str)
+{
+  int i;
+
+  for (i = 0; i < BOARD_SIZE; i++) {
+    *str++ = board[BLACK] & SQUARE(i) ? (board[KING] & SQUARE(i) ? 'B' : 'b') :
+      (board[WHITE] & SQUARE(i) ? (board[KING] & SQUARE(i) ? 'W' : 'w') : '.');
+    if (i % 4 == 3)
+      *str++ = ' ';
+  }
+  *str++ = btm ? 'b' : 'w';
+  *str = 0;
+}
+
+/*
+ * Plays one game from the opening, player[BLACK] and player[WHITE]
+ * being the engines.
+ *
+ * \return The result for black: 2 a win, 1 a draw, 0 a loss
+ */
+static int play_game(struct engine **player, const struct opening *o, int *bad)
+{
+  bitboard board[N_BOARDS];
+  struct move move;
+  char pos[64], line[256], *p;
+  bool color = o->btm;
+  int ply, quiet = 0;
+
+  COPY_BOARD(board, o->board);
+  *bad = -1;
+
+  for (ply = 0; ply < MAX_PLIES && quiet < MAX_QUIET; ply++) {
+    if (count_moves(board, color) == 0)
+      break;
+
+    /* the engines keep no history, so the position alone is enough, and
+       its line stays short however long the game is                   */
+    position_string(board, color, pos);
+    fprintf(player[(int)color]->in, "position %s\n%s\n", pos, go_cmd);
+    fflush(player[(int)color]->in);
+
+    do
+      if (!read_line(player[(int)color], line, sizeof(line))) {
+	*bad = color;
+	break;
+      }
+    while (strncmp(line, "bestmove ", 9));
+
+    if (*bad < 0) {
+      p = strtok(line + 9, " \t\r\n");
+      if (p == NULL || !find_move(board, color, p, &move))
+	*bad = color;
+    }
+    if (*bad >= 0)
+      return color ? 0 : 2;
+
+    /* men only move forward, so a man move or a capture is progress */
+    if ((board[(int)color] & ~board[KING] & ~move.board[(int)color]) ||
+	move.board[(int)!color] != board[(int)!color])
+      quiet = 0;
+    else
+      quiet++;
+
+    COPY_BOARD(board, move.board);
+    color = !color;
+  }
+
+  if (ply < MAX_PLIES && quiet < MAX_QUIET)
+    return color ? 0 : 2;
+  return 1;
+}
+
+/* the expected score at elo */
+static double elo_score(double elo)
+{
+  return 1 / (1 + pow(10, -elo / 400));
+}
+
+/* the Elo difference a score gives, within +-999 */
+static double score_elo(double s)
+{
+  return s <= 0.0005 ? -999 : s >= 0.9995 ? 999 : -400 * log10(1 / s - 1);
+}
+
+/*
+ * Log likelihood ratio of elo1 against elo0, with the normal
+ * approximation to the trinomial distribution of the results.
+ */
+static double llr(void)
+{
+  double n = wins + draws + losses, s, var, s0, s1;
+
+  if (n == 0)
+    return 0;
+  s = (wins + draws / 2.0) / n;
+  var = (wins * (1 - s) * (1 - s) + draws * (0.5 - s) * (0.5 - s) +
+	 losses * s * s) / n;
+  if (var <= 0)
+    return 0;                   /* all results the same, no telling yet */
+  s0 = elo_score(elo0);
+  s1 = elo_score(elo1);
+
+  return n * (s1 - s0) * (2 * s - s0 - s1) / (2 * var);
+}
+
+static void print_result(FILE *fd)
+{
+  double n = wins + draws + losses, s, sd, elo, lo, hi;
+
+  if (n == 0)
+    return;
+  s = (wins + draws / 2.0) / n;
+  sd = sqrt(((wins * (1 - s) * (1 - s) + draws * (0.5 - s) * (0.5 - s) +
+	      losses * s * s) / n) / n);
+  elo = score_elo(s);
+  lo = score_elo(s - 1.96 * sd);
+  hi = score_elo(s + 1.96 * sd);
+
+  fprintf(fd, "%d games: +%d =%d -%d, score %.1f%%, Elo %.1f [%.1f, %.1f], LLR %.2f [%.2f, %.2f]\n",
+	  (int)n, wins, draws, losses, 100 * s, elo, lo, hi, llr(),
+	  log(beta / (1 - alpha)), log((1 - beta) / alpha));
+}
+
+static void *worker(void *arg)
+{
+  struct engine engine[2], *player[2];
+  int game, result, first, bad;
+  bool alive;
+  double l;
+
+  memset(engine, 0, sizeof(engine));
+  if (!start_engine(&engine[0], engine_cmd[0]) ||
+      !start_engine(&engine[1], engine_cmd[1])) {
+    stop_engine(&engine[0]);
+    return NULL;
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    game = next_game++;
+    pthread_mutex_unlock(&lock);
+    if (game >= n_games || decided)
+      break;
+
+    /* each opening twice, the first engine black in the first game */
+    first = game % 2 ? WHITE : BLACK;
+    player[first] = &engine[0];
+    player[!first] = &engine[1];
+    result = play_game(player, &openings[game / 2 % n_openings], &bad);
+    alive = bad < 0 ||
+      restart_engine(player[bad], engine_cmd[player[bad] == &engine[1]]);
+
+    pthread_mutex_lock(&lock);
+    if (first == WHITE)
+      result = 2 - result;
+    if (result == 2)
+      wins++;
+    else if (result == 1)
+      draws++;
+    else
+      losses++;
+    printf("game %d, opening %d, first engine %s: %s%s\n", game + 1,
+	   game / 2 % n_openings + 1, first ? "black" : "white",
+	   result == 2 ? "won" : result == 1 ? "drawn" : "lost",
+	   bad < 0 ? "" : " (no legal answer)");
+    l = llr();
+    if (!decided && (l <= log(beta / (1 - alpha)) || l >= log((1 - beta) / alpha))) {
+      decided = TRUE;
+      printf("SPRT: %s\n", l > 0 ? "elo1 accepted" : "elo0 accepted");
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&lock);
+
+    /* the other workers play the rest of the games */
+    if (!alive) {
+      fprintf(stderr, "cannot restart %s, a worker stops\n",
+	      engine_cmd[player[bad] == &engine[1]]);
+      break;
+    }
+  }
+
+  stop_engine(&engine[0]);
+  stop_engine(&engine[1]);
+
+  return NULL;
+}
+
+static bool add_opening(const bitboard *board, bool btm)
+{
+  if (n_openings % 256 == 0)
+    openings = (struct opening *)realloc(openings, (n_openings + 256) * sizeof(struct opening));
+  COPY_BOARD(openings[n_openings].board, board);
+  openings[n_openings].btm = btm;
+  n_openings++;
+
+  return TRUE;
+}
+
+/* a .wdp file gives one opening, any other file one per line */
+static bool read_openings(char *file)
+{
+  bitboard board[N_BOARDS];
+  char line[256];
+  bool color;
+  double time_left;
+  int len = strlen(file);
+  FILE *fd;
+
+  if (len > 4 && !strcmp(file + len - 4, ".wdp"))
+    return read_wdp(board, file, &color, &time_left) && add_opening(board, color);
+
+  if ((fd = fopen(file, "r")) == NULL) {
+    perror(file);
+    return FALSE;
+  }
+  while (fgets(line, sizeof(line), fd))
+    if (parse_position(line, board, &color))
+      add_opening(board, color);
+  fclose(fd);
+
+  return TRUE;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ./match [-j workers] [-n games] [-t ms | -N nodes | -d depth]\n");
+  fprintf(stderr, "               [-s elo0,elo1,alpha,beta] [-o openings]... engine1 engine2\n");
+  fprintf(stderr, "          -j  Games played at a time (all cores)\n");
+  fprintf(stderr, "          -n  Most games (1000)\n");
+  fprintf(stderr, "          -t  Time per move in milliseconds (100)\n");
+  fprintf(stderr, "          -N  Nodes per move instead\n");
+  fprintf(stderr, "          -d  Depth per move instead\n");
+  fprintf(stderr, "          -s  SPRT bounds (0,5,0.05,0.05)\n");
+  fprintf(stderr, "          -o  A .wdp file or a file of positions (starts/*.wdp)\n");
+  fprintf(stderr, "       An engine is a program with its arguments, such as\n");
+  fprintf(stderr, "       \"./checkers --eval=ntuple\"; --protocol is added.\n");
+}
+
+int main(int argc, char *argv[])
+{
+  pthread_t thread[MAX_WORKERS];
+  glob_t g;
+  int c, i, n_workers, movetime = 100, nodes = 0, depth = 0;
+
+  n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  n_games = 1000;
+  signal(SIGPIPE, SIG_IGN);
+
+  while ((c = getopt(argc, argv, "j:n:t:N:d:s:o:")) != -1)
+    switch (c) {
+    case 'j':
+      n_workers = atoi(optarg);
+      break;
+    case 'n':
+      n_games = atoi(optarg);
+      break;
+    case 't':
+      movetime = atoi(optarg);
+      break;
+    case 'N':
+      nodes = atoi(optarg);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 's':
+      if (sscanf(optarg, "%lf,%lf,%lf,%lf", &elo0, &elo1, &alpha, &beta) != 4) {
+	usage();
+	return 1;
+      }
+      break;
+    case 'o':
+      if (!read_openings(optarg))
+	return 1;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+
+  if (optind != argc - 2) {
+    usage();
+    return 1;
+  }
+  engine_cmd[0] = argv[optind];
+  engine_cmd[1] = argv[optind + 1];
+  n_workers = MIN(MAX(n_workers, 1), MAX_WORKERS);
+
+  if (n_openings == 0) {
+    if (glob("starts/*.wdp", 0, NULL, &g) == 0) {
+      for (i = 0; i < (int)g.gl_pathc; i++)
+	read_openings(g.gl_pathv[i]);
+      globfree(&g);
+    }
+    if (n_openings == 0) {
+      fprintf(stderr, "No openings\n");
+      return 1;
+    }
+  }
+
+  if (nodes)
+    sprintf(go_cmd, "go nodes %d", nodes);
+  else if (depth)
+    sprintf(go_cmd, "go depth %d", depth);
+  else
+    sprintf(go_cmd, "go movetime %d", movetime);
+  /* a fixed time answer may be late by a depth, the others take what they take */
+  answer_ms = nodes || depth ? 600000 : 10 * movetime + 5000;
+
+  fprintf(stderr, "%d openings, %d workers, %s\n", n_openings, n_workers, go_cmd);
+
+  for (i = 0; i < n_workers; i++)
+    pthread_create(&thread[i], NULL, worker, NULL);
+  for (i = 0; i < n_workers; i++)
+    pthread_join(thread[i], NULL);
+
+  print_result(stdout);
+
+  return 0;
+}
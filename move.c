@@ -5,160 +5,202 @@
 #include <string.h>
 #include "checkers.h"
 
-int generate_moves(bitboard *board, const bool color, struct move *move_list)
+static int capture_gen(bitboard *board, bitboard mask, const bool color,
+		       struct delta *next_delta);
+
+/* expand a list of deltas into the full boards they lead to */
+static void deltas_to_moves(bitboard *board, const bool color,
+			    struct delta *delta_list, struct move *move_list,
+			    int n)
 {
-  int n = 0;
-
-#ifdef DEBUG  
-  printf("MOVE: generate_moves, color = %s\n", color ? "black" : "white");
-#endif 
- 
-  if ((n = try_capture(board, 0xffffffff, color, move_list)) > 0) {    
-    return n;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    COPY_BOARD(move_list[i].board, board);
+    make_move(move_list[i].board, &delta_list[i], color);
   }
+}
+
+int generate_moves(bitboard *board, const bool color, struct move *move_list)
+{
+  struct delta delta_list[MAX_MOVES];
+  int n;
 
-  return try_move(board, color, move_list);
+  n = generate_deltas(board, color, delta_list);
+  deltas_to_moves(board, color, delta_list, move_list, n);
+
+  return n;
 }
 
 int try_move(bitboard *board, const bool color, struct move *next_move)
 {
-  bitboard next, to, from;
-  const bitboard empty = ~(board[BLACK] | board[WHITE]);
-  const bitboard move_up = color ? board[KING] : 0xffffffff;
-  const bitboard move_down = !color ? board[KING] : 0xffffffff;
-    
-  int n = 0, i;
-
-#ifdef DEBUG
-  printf("MOVE: try_move\n");
-#endif
+  struct delta delta_list[MAX_MOVES];
+  int n;
 
-  // check down neighbors
-  for (i = 0; i < N_DIRS; i++) {
-    to = DOWN_NEIGHBOR(board[(int)color] & move_down, i) & empty; 
-    while (to) {
-      next = LAST_ONE(to);
-      from = UP_NEIGHBOR(next, i);
-
-      // modify move board
-      next_move->board[(int)color] = (board[(int)color] | next) & ~from;
-      next_move->board[(int)!color] = board[(int)!color];
-      next_move->board[KING] = ((board[KING] | (next & king_bits[(int)color])) & ~from) | 
-	(DOWN_NEIGHBOR(board[KING], i) & next);
-
-      next_move++;
-      n++;
-      to ^= next;
-    }
-  }
+  n = delta_move(board, color, delta_list);
+  deltas_to_moves(board, color, delta_list, next_move, n);
 
-  // check up neighbors
-  for (i = 0; i < N_DIRS; i++) {
-    to = UP_NEIGHBOR(board[(int)color] & move_up, i) & empty;
-    while (to) {
-      next = LAST_ONE(to);
-      from = DOWN_NEIGHBOR(next, i);
-
-      // modify move board
-      next_move->board[(int)color] = (board[(int)color] | next) & ~from;
-      next_move->board[(int)!color] = board[(int)!color];
-      next_move->board[KING] = ((board[KING] | (next & king_bits[(int)color])) & ~from) | 
-	(UP_NEIGHBOR(board[KING], i) & next);
-
-      next_move++;
-      n++;
-      to ^= next;
-    }
-  }
-  
-#ifdef DEBUG
-  printf("MOVE: %d possible moves\n", n);
-#endif
-  
   return n;
 }
 
 int try_capture(bitboard *board, bitboard mask, const bool color, struct move *next_move)
 {
-  bitboard to, cap, from, next;
-  const bitboard empty = ~(board[WHITE] | board[BLACK]);
-  const bitboard move_up = (color ? board[KING] : 0xffffffff) & mask;
-  const bitboard move_down = (!color ? board[KING] : 0xffffffff) & mask;
-  struct move cur_move;
+  struct delta delta_list[MAX_MOVES];
+  int n;
 
-  int n = 0, i, leaves = 0;
+  n = capture_gen(board, mask, color, delta_list);
+  deltas_to_moves(board, color, delta_list, next_move, n);
 
-#ifdef DEBUG
-  printf("MOVE: try_capture\n");
-#endif
+  return n;
+}
 
-  // check down neighbors
-  for (i = 0; i < N_DIRS; i++) {
-    to = DOWN_NEIGHBOR(DOWN_NEIGHBOR(board[(int)color] & move_down, i) & board[(int)!color], i) & empty;
-    while (to) {
-      next = LAST_ONE(to);
-      cap = UP_NEIGHBOR(next, i);
-      from = UP_NEIGHBOR(cap, i);
-
-      to ^= next;
-      
-      cur_move.board[(int)color] = (board[(int)color] & ~from) | next;
-      cur_move.board[(int)!color] = board[(int)!color] & ~cap;
-      cur_move.board[KING] = ((board[KING] & ~from) & ~cap) | 
-	(next & (king_bits[(int)color] | DOWN_NEIGHBOR(DOWN_NEIGHBOR(board[KING], i), i)));
-
-      /* must stop once we get a king */
-      if (!(from & board[KING]) && (next & cur_move.board[KING]))
-	next = 0;
-      
-      if ((n = try_capture(cur_move.board, next, color, next_move+leaves)) == 0) {
-	(next_move+leaves)->board[WHITE] = cur_move.board[WHITE];
-	(next_move+leaves)->board[BLACK] = cur_move.board[BLACK];
-	(next_move+leaves)->board[KING] = cur_move.board[KING];
-	leaves++;
-      }
-      else
-	leaves += n;
-
-    }
-  }
-  
-  // check up neighbors
-  for (i = 0; i < N_DIRS; i++) {
-    to = UP_NEIGHBOR(UP_NEIGHBOR(board[(int)color] & move_up, i) & board[(int)!color], i) & empty;
-    while (to) {
-      next = LAST_ONE(to);
-      cap = DOWN_NEIGHBOR(next, i);
-      from = DOWN_NEIGHBOR(cap, i);
-
-      to ^= next;
-
-      cur_move.board[(int)color] = (board[(int)color] & ~from) | next;
-      cur_move.board[(int)!color] = board[(int)!color] & ~cap;
-      cur_move.board[KING] = ((board[KING] & ~from) & ~cap) | 
-	(next & (king_bits[(int)color] | UP_NEIGHBOR(UP_NEIGHBOR(board[KING], i), i)));
-
-      /* must stop once we get a king */
-      if (!(from & board[KING]) && (next & cur_move.board[KING]))
-	next = 0;
-      
-      if ((n = try_capture(cur_move.board, next, color, next_move+leaves)) == 0) {
-	(next_move+leaves)->board[WHITE] = cur_move.board[WHITE];
-	(next_move+leaves)->board[BLACK] = cur_move.board[BLACK];
-	(next_move+leaves)->board[KING] = cur_move.board[KING];
-	leaves++;
-      }
-      else
-	leaves += n;
-    }
-  }
-  
-#ifdef DEBUG
-  printf("MOVE: leaves in capture tree = %d\n", leaves);
-#endif
-  
-  return leaves;
+/* 
+ * A piece can jump at most every enemy piece, so the capture stack
+ * never needs more frames than this.
+ */
+#define MAX_JUMPS 12
+
+/* one step of a jump sequence in capture_gen() */
+struct jump_frame {
+  bitboard board[N_BOARDS];   /* position after the jumps so far */
+  bitboard land[2 * N_DIRS];  /* landing squares not yet tried (down, then up) */
+  bitboard origin;            /* square the jumping piece started from */
+  bitboard captured;          /* pieces jumped so far */
+};
+
+/* the generators for each color, see move_color.h */
+#define COLOR BLACK
+#define CNAME(f) f ## _black
+#include "move_color.h"
+#undef COLOR
+#undef CNAME
+
+#define COLOR WHITE
+#define CNAME(f) f ## _white
+#include "move_color.h"
+#undef COLOR
+#undef CNAME
+
+int delta_move(bitboard *board, const bool color, struct delta *next_delta)
+{
+  return color ? delta_move_black(board, next_delta) :
+    delta_move_white(board, next_delta);
 }
 
+int delta_capture(bitboard *board, const bool color, struct delta *next_delta)
+{
+  return capture_gen(board, 0xffffffff, color, next_delta);
+}
 
+static int capture_gen(bitboard *board, bitboard mask, const bool color,
+		       struct delta *next_delta)
+{
+  return color ? capture_gen_black(board, mask, next_delta) :
+    capture_gen_white(board, mask, next_delta);
+}
 
+/**
+ * Tells whether color has a jump, straight from the neighbor masks.
+ */
+bool has_capture(bitboard *board, const bool color)
+{
+  return color ? has_capture_black(board) : has_capture_white(board);
+}
+
+/**
+ * Counts the jumps of color from the neighbor masks, which is exact as
+ * long as none of them can be continued.  A piece that has just jumped
+ * cannot jump back over the piece it took, so only the other three
+ * directions (the forward ones for a man) are checked for a second
+ * jump, and in those the board before the jump gives the right answer.
+ *
+ * \return The number of jumps, or -1 if some jump can be continued
+ */
+int count_jumps(bitboard *board, const bool color)
+{
+  return color ? count_jumps_black(board) : count_jumps_white(board);
+}
+
+/**
+ * Counts the moves color has, i.e. what generate_moves() would return,
+ * without building them.  Plain moves and single jumps are counted with
+ * a population count of the neighbor masks; only when a jump can be
+ * continued are the jump sequences walked (as deltas) to count them.
+ */
+int count_moves(bitboard *board, const bool color)
+{
+  return color ? count_moves_black(board) : count_moves_white(board);
+}
+
+/**
+ * Makes a move on the board by XORing in the squares it changes.
+ *
+ * \return The captured kings, which unmake_move() needs to restore them
+ */
+bitboard make_move(bitboard *board, const struct delta *delta, const bool color)
+{
+  const bitboard from = SQUARE(delta->from), to = SQUARE(delta->to);
+  const bitboard cap_kings = board[KING] & delta->captured;
+
+  if (board[KING] & from)
+    board[KING] ^= from ^ to;
+  else if (delta->promote)
+    board[KING] ^= to;
+  board[KING] ^= cap_kings;
+
+  board[(int)color] ^= from ^ to;
+  board[(int)!color] ^= delta->captured;
+
+  return cap_kings;
+}
+
+/**
+ * Takes back a move made with make_move().  cap_kings is the value
+ * make_move() returned.
+ */
+void unmake_move(bitboard *board, const struct delta *delta, const bool color,
+		 bitboard cap_kings)
+{
+  const bitboard from = SQUARE(delta->from), to = SQUARE(delta->to);
+
+  if (delta->promote)
+    board[KING] ^= to;
+  else if (board[KING] & to)
+    board[KING] ^= from ^ to;
+  board[KING] ^= cap_kings;
+
+  board[(int)color] ^= from ^ to;
+  board[(int)!color] ^= delta->captured;
+}
+
+/**
+ * Finds the legal move color makes with move_str, as trans_string_move()
+ * reads it; jumps may also be written with x (11x18x25).
+ *
+ * \return FALSE if move_str is not one of the moves generate_moves() gives
+ */
+bool find_move(bitboard *board, const bool color, const char *move_str,
+	       struct move *move)
+{
+  struct move move_list[MAX_MOVES];
+  char buf[128], *p;
+  int n, i;
+
+  strncpy(buf, move_str, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for (p = buf; *p; p++)
+    if (*p == 'x')
+      *p = '-';
+
+  if (!trans_string_move(board, move, buf, color))
+    return FALSE;
+
+  n = generate_moves(board, color, move_list);
+  for (i = 0; i < n; i++)
+    if (move_list[i].board[BLACK] == move->board[BLACK] &&
+	move_list[i].board[WHITE] == move->board[WHITE] &&
+	move_list[i].board[KING] == move->board[KING])
+      return TRUE;
+
+  return FALSE;
+}
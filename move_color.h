@@ -0,0 +1,275 @@
+/*
+ * Move generation for one color
+ *
+ * Included by move.c once per color, with COLOR defined as BLACK or
+ * WHITE and CNAME(f) giving the name of f for that color, e.g.
+ * f ## _black.  With the color a constant the masks of the pieces that
+ * move down or up, the enemy board and the promotion row are constants
+ * too, so the generators have no branches on the color left.
+ */
+
+#if COLOR == BLACK
+#define DOWN_MOVERS(b) ((b)[BLACK])
+#define UP_MOVERS(b) ((b)[BLACK] & (b)[KING])
+#define CAN_GO_DOWN(land, king_land) (land)
+#define CAN_GO_UP(land, king_land) ((land) & (king_land))
+#else
+#define DOWN_MOVERS(b) ((b)[WHITE] & (b)[KING])
+#define UP_MOVERS(b) ((b)[WHITE])
+#define CAN_GO_DOWN(land, king_land) ((land) & (king_land))
+#define CAN_GO_UP(land, king_land) (land)
+#endif
+#define MINE(b) ((b)[COLOR])
+#define THEIRS(b) ((b)[!COLOR])
+#define PROMOTE_ROW king_bits[COLOR]
+
+static int CNAME(delta_move)(bitboard *board, struct delta *next_delta)
+{
+  bitboard next, to, from;
+  const bitboard empty = ~(board[BLACK] | board[WHITE]);
+
+  int n = 0, i;
+
+#ifdef DEBUG
+  printf("MOVE: delta_move\n");
+#endif
+
+  // check down neighbors
+  for (i = 0; i < N_DIRS; i++) {
+    to = DOWN_NEIGHBOR(DOWN_MOVERS(board), i) & empty;
+    while (to) {
+      next = LAST_ONE(to);
+      from = UP_NEIGHBOR(next, i);
+
+      next_delta->from = SQUARE_NUM(from);
+      next_delta->to = SQUARE_NUM(next);
+      next_delta->captured = 0;
+      next_delta->promote = !(from & board[KING]) && (next & PROMOTE_ROW);
+
+      next_delta++;
+      n++;
+      to ^= next;
+    }
+  }
+
+  // check up neighbors
+  for (i = 0; i < N_DIRS; i++) {
+    to = UP_NEIGHBOR(UP_MOVERS(board), i) & empty;
+    while (to) {
+      next = LAST_ONE(to);
+      from = DOWN_NEIGHBOR(next, i);
+
+      next_delta->from = SQUARE_NUM(from);
+      next_delta->to = SQUARE_NUM(next);
+      next_delta->captured = 0;
+      next_delta->promote = !(from & board[KING]) && (next & PROMOTE_ROW);
+
+      next_delta++;
+      n++;
+      to ^= next;
+    }
+  }
+
+#ifdef DEBUG
+  printf("MOVE: %d possible moves\n", n);
+#endif
+
+  return n;
+}
+
+/* landing squares of single jumps by the pieces in mask, per direction */
+static bitboard CNAME(jump_targets)(bitboard *board, bitboard mask, bitboard *land)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+  bitboard any = 0;
+  int i;
+
+  for (i = 0; i < N_DIRS; i++) {
+    land[i] = DOWN_NEIGHBOR(DOWN_NEIGHBOR(DOWN_MOVERS(board) & mask, i) & THEIRS(board), i) & empty;
+    land[N_DIRS + i] = UP_NEIGHBOR(UP_NEIGHBOR(UP_MOVERS(board) & mask, i) & THEIRS(board), i) & empty;
+    any |= land[i] | land[N_DIRS + i];
+  }
+
+  return any;
+}
+
+/**
+ * Generates every jump sequence of the pieces in mask, depth first with
+ * an explicit stack.  Sequences that end in the same position (a king
+ * reaching one square along different paths over the same pieces) are
+ * only listed once, and no more than MAX_MOVES are stored.
+ *
+ * \return The number of deltas written to next_delta
+ */
+static int CNAME(capture_gen)(bitboard *board, bitboard mask, struct delta *next_delta)
+{
+  struct jump_frame stack[MAX_JUMPS + 1], *f, *child;
+  bitboard next, cap, from;
+  int sp = 0, n = 0, d, i, j;
+  bool crowned;
+
+#ifdef DEBUG
+  printf("MOVE: capture_gen\n");
+#endif
+
+  f = &stack[0];
+  if (!CNAME(jump_targets)(board, mask, f->land))
+    return 0;
+  COPY_BOARD(f->board, board);
+  f->origin = 0;
+  f->captured = 0;
+
+  while (sp >= 0) {
+    f = &stack[sp];
+
+    for (d = 0; d < 2 * N_DIRS && !f->land[d]; d++);
+    if (d == 2 * N_DIRS) {
+      sp--;
+      continue;
+    }
+
+    next = LAST_ONE(f->land[d]);
+    f->land[d] ^= next;
+    i = d % N_DIRS;
+    if (d < N_DIRS) {
+      cap = UP_NEIGHBOR(next, i);
+      from = UP_NEIGHBOR(cap, i);
+    }
+    else {
+      cap = DOWN_NEIGHBOR(next, i);
+      from = DOWN_NEIGHBOR(cap, i);
+    }
+
+    child = &stack[sp + 1];
+    MINE(child->board) = (MINE(f->board) & ~from) | next;
+    THEIRS(child->board) = THEIRS(f->board) & ~cap;
+    child->board[KING] = (f->board[KING] & ~from & ~cap) |
+      ((f->board[KING] & from) ? next : (next & PROMOTE_ROW));
+    child->origin = sp ? f->origin : from;
+    child->captured = f->captured | cap;
+
+    /* must stop once we get a king */
+    crowned = !(from & f->board[KING]) && (next & child->board[KING]);
+
+    if (!crowned && sp < MAX_JUMPS &&
+	CNAME(jump_targets)(child->board, next, child->land)) {
+      sp++;
+      continue;
+    }
+
+    /* end of a sequence, store it unless it is already listed */
+    for (j = 0; j < n; j++)
+      if (next_delta[j].captured == child->captured &&
+	  next_delta[j].to == SQUARE_NUM(next) &&
+	  next_delta[j].from == SQUARE_NUM(child->origin))
+	break;
+
+    if (j == n && n < MAX_MOVES) {
+      next_delta[n].from = SQUARE_NUM(child->origin);
+      next_delta[n].to = SQUARE_NUM(next);
+      next_delta[n].captured = child->captured;
+      next_delta[n].promote = crowned;
+      n++;
+    }
+  }
+
+#ifdef DEBUG
+  printf("MOVE: %d different capture sequences\n", n);
+#endif
+
+  return n;
+}
+
+int CNAME(generate_deltas)(bitboard *board, struct delta *delta_list)
+{
+  int n = 0;
+
+#ifdef DEBUG
+  printf("MOVE: generate_deltas, color = %s\n", COLOR ? "black" : "white");
+#endif
+
+  if ((n = CNAME(capture_gen)(board, 0xffffffff, delta_list)) > 0) {
+    return n;
+  }
+
+  return CNAME(delta_move)(board, delta_list);
+}
+
+static bool CNAME(has_capture)(bitboard *board)
+{
+  bitboard land[2 * N_DIRS];
+
+  return CNAME(jump_targets)(board, 0xffffffff, land) != 0;
+}
+
+static int CNAME(count_jumps)(bitboard *board)
+{
+  const bitboard empty = ~(board[BLACK] | board[WHITE]);
+  const bitboard kings = MINE(board) & board[KING];
+  bitboard land, king_land, down, up, cont;
+  int n = 0, i, j;
+
+  /*
+   * For the landing squares of each jump direction, down and up are
+   * those from which the piece may go on down and up
+   */
+  for (i = 0; i < N_DIRS; i++) {
+    land = DOWN_NEIGHBOR(DOWN_NEIGHBOR(DOWN_MOVERS(board), i) & THEIRS(board), i) & empty;
+    king_land = DOWN_NEIGHBOR(DOWN_NEIGHBOR(kings, i), i);
+    down = CAN_GO_DOWN(land, king_land);
+    up = CAN_GO_UP(land, king_land);
+    cont = 0;
+    for (j = 0; j < N_DIRS; j++) {
+      cont |= DOWN_NEIGHBOR(DOWN_NEIGHBOR(down, j) & THEIRS(board), j);
+      if (j != i)
+	cont |= UP_NEIGHBOR(UP_NEIGHBOR(up, j) & THEIRS(board), j);
+    }
+    if (cont & empty)
+      return -1;
+    n += BIT_COUNT(land);
+
+    land = UP_NEIGHBOR(UP_NEIGHBOR(UP_MOVERS(board), i) & THEIRS(board), i) & empty;
+    king_land = UP_NEIGHBOR(UP_NEIGHBOR(kings, i), i);
+    down = CAN_GO_DOWN(land, king_land);
+    up = CAN_GO_UP(land, king_land);
+    cont = 0;
+    for (j = 0; j < N_DIRS; j++) {
+      cont |= UP_NEIGHBOR(UP_NEIGHBOR(up, j) & THEIRS(board), j);
+      if (j != i)
+	cont |= DOWN_NEIGHBOR(DOWN_NEIGHBOR(down, j) & THEIRS(board), j);
+    }
+    if (cont & empty)
+      return -1;
+    n += BIT_COUNT(land);
+  }
+
+  return n;
+}
+
+int CNAME(count_moves)(bitboard *board)
+{
+  struct delta delta_list[MAX_MOVES];
+  const bitboard empty = ~(board[BLACK] | board[WHITE]);
+  int n = 0, i;
+
+  if (CNAME(has_capture)(board)) {
+    if ((n = CNAME(count_jumps)(board)) >= 0)
+      return n;
+    return CNAME(capture_gen)(board, 0xffffffff, delta_list);
+  }
+
+  for (i = 0; i < N_DIRS; i++) {
+    n += BIT_COUNT(DOWN_NEIGHBOR(DOWN_MOVERS(board), i) & empty);
+    n += BIT_COUNT(UP_NEIGHBOR(UP_MOVERS(board), i) & empty);
+  }
+
+  return n;
+}
+
+#undef DOWN_MOVERS
+#undef UP_MOVERS
+#undef CAN_GO_DOWN
+#undef CAN_GO_UP
+#undef MINE
+#undef THEIRS
+#undef PROMOTE_ROW
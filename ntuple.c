@@ -0,0 +1,431 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checkers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NTUPLE_X86
+#endif
+
+/*
+ * N-tuple evaluator
+ *
+ * An alternative to eval() that does no analysis of the position: the
+ * board is covered with tuples, fixed sets of up to NTUPLE_MAX_SIZE
+ * fields, and each tuple has a table with an int16 weight for every way
+ * its fields can be filled.  A field holds a digit, 1 for a black brick
+ * and 2 for a white one plus 2 for a king, so a tuple of n fields has
+ * 5^n entries.  The value of a position is the sum of the weights its
+ * tuples index, plus a tempo weight for the side to move.
+ *
+ * The index of a tuple takes three bit extractions, one per bitboard,
+ * and lookups of the base 5 value of the extracted bits.  The scalar
+ * version extracts with a loop over the bits, the BMI2 version with
+ * pext, and the AVX2 version also gathers the weights of 8 tuples at
+ * once.  ./test -ntuple times it against the BMI2 one, which is what
+ * the gathers gain; with 8 tuples that was nothing, so the BMI2 one is
+ * preferred.
+ *
+ * The tables are fitted to game results with ./tune -n and loaded with
+ * ntuple_load().  The default tables hold the local terms of eval()
+ * (material, safe men, back ranks and dog holes) on four tuples that
+ * cover the board two rows each, and zeros on four more tuples that
+ * overlap them; they are where a fit starts.
+ */
+
+/* tuples gathered by one AVX2 gather, n_tuples is rounded up to it */
+#define NTUPLE_LANES 8
+
+typedef int (*ntuple_fn)(bitboard *board);
+
+static int ntuple_scalar(bitboard *board);
+#ifdef NTUPLE_X86
+static int ntuple_bmi2(bitboard *board);
+static int ntuple_avx2(bitboard *board);
+#endif
+
+static const struct {
+  const char *name;
+  ntuple_fn fn;
+} ntuple_impls[] = {
+#ifdef NTUPLE_X86
+  { "bmi2", ntuple_bmi2 },
+  { "avx2", ntuple_avx2 },
+#endif
+  { "scalar", ntuple_scalar },
+};
+#define N_NTUPLE_IMPLS (int)(sizeof(ntuple_impls) / sizeof(ntuple_impls[0]))
+
+static int ntuple_impl = -1;   /* index into ntuple_impls, -1 until chosen */
+
+/** Whether the search evaluates with the n-tuples instead of eval() */
+bool ntuple_on;
+
+static int n_tuples;                     /* a multiple of NTUPLE_LANES */
+static bitboard tuple_mask[NTUPLE_MAX];  /* the fields of each tuple */
+static int tuple_offset[NTUPLE_MAX];     /* its table in tuple_weights */
+static int16 *tuple_weights;             /* all tables, one after the other */
+static int tempo;                        /* for black to move */
+
+/* base 5 value of a pattern of extracted bits, with digits 0 and 1 */
+static int pow5[1 << NTUPLE_MAX_SIZE];
+
+/* the default tuples, by rows of 4 fields */
+static const bitboard default_tuples[] = {
+  0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000,    /* rows 1-2, 3-4, 5-6, 7-8 */
+  0x00000ff0, 0x000ff000, 0x0ff00000,                /* rows 2-3, 4-5, 6-7 */
+  0x00666600                                         /* the center, rows 3-6 */
+};
+#define N_DEFAULT_TUPLES (int)(sizeof(default_tuples) / sizeof(default_tuples[0]))
+
+/* whether the cpu we run on can execute implementation i */
+static bool ntuple_supported(int i)
+{
+#ifdef NTUPLE_X86
+  if (ntuple_impls[i].fn == ntuple_avx2)
+    return __builtin_cpu_supports("avx2") != 0 &&
+      __builtin_cpu_supports("bmi2") != 0;
+  if (ntuple_impls[i].fn == ntuple_bmi2)
+    return __builtin_cpu_supports("bmi2") != 0;
+#endif
+  return TRUE;
+}
+
+/**
+ * Selects the n-tuple implementation by name ("avx2", "bmi2" or
+ * "scalar"), or the fastest one the cpu supports if name is NULL.
+ *
+ * \return FALSE if the implementation is unknown or not supported
+ */
+bool ntuple_select(const char *name)
+{
+  int i;
+
+#ifdef NTUPLE_X86
+  __builtin_cpu_init();
+#endif
+
+  for (i = 0; i < N_NTUPLE_IMPLS; i++)
+    if ((name == NULL || !strcmp(name, ntuple_impls[i].name)) &&
+	ntuple_supported(i)) {
+      ntuple_impl = i;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/** Name of the n-tuple implementation in use */
+const char *ntuple_name()
+{
+  if (ntuple_impl < 0)
+    ntuple_select(NULL);
+
+  return ntuple_impls[ntuple_impl].name;
+}
+
+/* the bits of x under mask, packed together in the order of mask */
+static unsigned int extract(bitboard x, bitboard mask)
+{
+  unsigned int bits = 0, bit = 1;
+
+  for (; mask; mask &= mask - 1, bit <<= 1)
+    if (x & mask & -mask)
+      bits |= bit;
+
+  return bits;
+}
+
+/* entries in the table of tuple t, 5^n for n fields */
+static int table_size(int t)
+{
+  int n, size = 1;
+
+  for (n = BIT_COUNT(tuple_mask[t]); n > 0; n--)
+    size *= 5;
+
+  return size;
+}
+
+/*
+ * Makes room for tables of the tuples in masks, padded with empty tuples
+ * to a multiple of NTUPLE_LANES, all weights 0.  One more weight at the
+ * end lets the gather read 32 bits at the last one.
+ */
+static bool alloc_tables(const bitboard *masks, int n)
+{
+  int t, k, size = 0;
+
+  if (n > NTUPLE_MAX)
+    return FALSE;
+
+  for (k = 0; k < (1 << NTUPLE_MAX_SIZE); k++) {
+    pow5[k] = 0;
+    for (t = NTUPLE_MAX_SIZE - 1; t >= 0; t--)
+      pow5[k] = 5 * pow5[k] + ((k >> t) & 1);
+  }
+
+  n_tuples = (n + NTUPLE_LANES - 1) / NTUPLE_LANES * NTUPLE_LANES;
+  for (t = 0; t < n_tuples; t++) {
+    tuple_mask[t] = t < n ? masks[t] : 0;
+    if (BIT_COUNT(tuple_mask[t]) > NTUPLE_MAX_SIZE)
+      return FALSE;
+    tuple_offset[t] = size;
+    size += table_size(t);
+  }
+
+  free(tuple_weights);
+  tuple_weights = (int16 *)calloc(size + 1, sizeof(int16));
+  tempo = 0;
+
+  return tuple_weights != NULL;
+}
+
+/*
+ * Fills the default tables: each of the first four tuples holds two
+ * rows and gets the local terms of eval() for them.  The back ranks
+ * and both dog holes lie within rows 1-2 and 7-8.
+ */
+static void default_tables(void)
+{
+  const int back_rank[5] = { BACK_0, BACK_1, BACK_2, BACK_3, 0 };
+  bitboard board[N_BOARDS], mask, field;
+  int t, idx, k, d, val;
+
+  alloc_tables(default_tuples, N_DEFAULT_TUPLES);
+  tempo = BLACK_TO_MOVE;
+
+  for (t = 0; t < 4; t++)
+    for (idx = 0; idx < table_size(t); idx++) {
+      /* the position the index stands for */
+      board[WHITE] = board[BLACK] = board[KING] = 0;
+      mask = tuple_mask[t];
+      for (k = idx; mask; mask ^= field, k /= 5) {
+	field = LAST_ONE(mask);
+	d = k % 5;
+	if (d == 1 || d == 3)
+	  board[BLACK] |= field;
+	if (d == 2 || d == 4)
+	  board[WHITE] |= field;
+	if (d >= 3)
+	  board[KING] |= field;
+      }
+
+      val = MAT_MAN * (BIT_COUNT(board[BLACK] & ~board[KING]) - BIT_COUNT(board[WHITE] & ~board[KING])) +
+	MAT_KING * (BIT_COUNT(board[BLACK] & board[KING]) - BIT_COUNT(board[WHITE] & board[KING])) +
+	SAFE_MAN * (BIT_COUNT(board[BLACK] & ~board[KING] & 0x18181818) -
+		    BIT_COUNT(board[WHITE] & ~board[KING] & 0x18181818));
+      if (t == 0) {
+	val -= back_rank[BIT_COUNT(board[BLACK] & king_bits[WHITE])];
+	if ((board[WHITE] & 0x00000010) && (board[BLACK] & 0x00000001))
+	  val += DOG_HOLE;
+      }
+      if (t == 3) {
+	val += back_rank[BIT_COUNT(board[WHITE] & king_bits[BLACK])];
+	if ((board[BLACK] & 0x08000000) && (board[WHITE] & 0x80000000))
+	  val -= DOG_HOLE;
+      }
+
+      tuple_weights[tuple_offset[t] + idx] = val;
+    }
+}
+
+/**
+ * Loads n-tuple tables from file, or sets up the default tables if file
+ * is NULL.  The file has the magic "NTUP", the number of tuples and the
+ * tempo weight as 32-bit integers, a 32-bit field mask for each tuple,
+ * and then the table of each tuple as 5^n 16-bit weights, the digit of
+ * the lowest field lowest.  All numbers are little endian.
+ *
+ * \return FALSE if the file cannot be read or is not a table file
+ */
+bool ntuple_load(const char *file)
+{
+  bitboard masks[NTUPLE_MAX];
+  char magic[4];
+  int n, t, ok;
+  FILE *fd;
+
+  if (file == NULL) {
+    default_tables();
+    return TRUE;
+  }
+
+  fd = fopen(file, "rb");
+  if (fd == NULL) {
+    perror(file);
+    return FALSE;
+  }
+
+  ok = fread(magic, 1, 4, fd) == 4 && !memcmp(magic, "NTUP", 4) &&
+    fread(&n, sizeof(int), 1, fd) == 1 && n > 0 && n <= NTUPLE_MAX &&
+    fread(&t, sizeof(int), 1, fd) == 1 &&
+    fread(masks, sizeof(bitboard), n, fd) == (size_t)n &&
+    alloc_tables(masks, n);
+  tempo = t;
+
+  for (t = 0; ok && t < n; t++)
+    ok = fread(tuple_weights + tuple_offset[t], sizeof(int16), table_size(t), fd) ==
+      (size_t)table_size(t);
+
+  fclose(fd);
+  if (!ok) {
+    fprintf(stderr, "%s: not an n-tuple table file\n", file);
+    default_tables();
+  }
+
+  return ok;
+}
+
+/**
+ * Writes the tables in use in the format ntuple_load() reads.
+ *
+ * \return FALSE if the file cannot be written
+ */
+bool ntuple_save(const char *file)
+{
+  int n, t, ok;
+  FILE *fd;
+
+  if (tuple_weights == NULL)
+    default_tables();
+
+  fd = fopen(file, "wb");
+  if (fd == NULL) {
+    perror(file);
+    return FALSE;
+  }
+
+  /* the padding tuples are left out */
+  for (n = n_tuples; n > 0 && !tuple_mask[n - 1]; n--);
+
+  ok = fwrite("NTUP", 1, 4, fd) == 4 &&
+    fwrite(&n, sizeof(int), 1, fd) == 1 &&
+    fwrite(&tempo, sizeof(int), 1, fd) == 1 &&
+    fwrite(tuple_mask, sizeof(bitboard), n, fd) == (size_t)n;
+  for (t = 0; ok && t < n; t++)
+    ok = fwrite(tuple_weights + tuple_offset[t], sizeof(int16), table_size(t), fd) ==
+      (size_t)table_size(t);
+
+  return fclose(fd) == 0 && ok;
+}
+
+/**
+ * Where the weights of a position are, for fitting the tables (see
+ * tune.c).  The padding tuples are left out, their weights stay 0.
+ *
+ * \param board Board configuration
+ * \param idx Gets the index in ntuple_weights() of each tuple's weight
+ * \return The number of tuples
+ */
+int ntuple_index(bitboard *board, int *idx)
+{
+  int t;
+
+  if (tuple_weights == NULL)
+    default_tables();
+
+  for (t = 0; t < n_tuples && tuple_mask[t]; t++)
+    idx[t] = tuple_offset[t] + pow5[extract(board[BLACK], tuple_mask[t])] +
+      2 * (pow5[extract(board[WHITE], tuple_mask[t])] +
+	   pow5[extract(board[KING], tuple_mask[t])]);
+
+  return t;
+}
+
+/**
+ * The weights of all tables in use, for fitting them.
+ *
+ * \param size Gets the number of weights
+ * \param tempo_weight Gets the tempo weight, for black to move
+ * \return The weights, one table after the other
+ */
+int16 *ntuple_weights(int *size, int **tempo_weight)
+{
+  if (tuple_weights == NULL)
+    default_tables();
+
+  *size = tuple_offset[n_tuples - 1] + table_size(n_tuples - 1);
+  *tempo_weight = &tempo;
+
+  return tuple_weights;
+}
+
+/**
+ * Evaluates a position with the n-tuple tables, the default ones unless
+ * ntuple_load() was called.
+ *
+ * \param board Board configuration
+ * \param btm The color whose turn it is ("black to move")
+ * \return An integer. Positive values express an advantage for black and vv.
+ */
+int ntuple_eval(bitboard *board, bool btm)
+{
+  if (ntuple_impl < 0)
+    ntuple_select(NULL);
+  if (tuple_weights == NULL)
+    default_tables();
+
+  if (board[WHITE] == 0)
+    return MAT_VICTORY;
+  if (board[BLACK] == 0)
+    return -MAT_VICTORY;
+
+  return ntuple_impls[ntuple_impl].fn(board) + (btm ? tempo : -tempo);
+}
+
+static int ntuple_scalar(bitboard *board)
+{
+  int t, sum = 0;
+
+  for (t = 0; t < n_tuples; t++)
+    sum += tuple_weights[tuple_offset[t] + pow5[extract(board[BLACK], tuple_mask[t])] +
+			 2 * (pow5[extract(board[WHITE], tuple_mask[t])] +
+			      pow5[extract(board[KING], tuple_mask[t])])];
+
+  return sum;
+}
+
+#ifdef NTUPLE_X86
+
+__attribute__((target("bmi2")))
+static int ntuple_bmi2(bitboard *board)
+{
+  int t, sum = 0;
+
+  for (t = 0; t < n_tuples; t++)
+    sum += tuple_weights[tuple_offset[t] + pow5[_pext_u32(board[BLACK], tuple_mask[t])] +
+			 2 * (pow5[_pext_u32(board[WHITE], tuple_mask[t])] +
+			      pow5[_pext_u32(board[KING], tuple_mask[t])])];
+
+  return sum;
+}
+
+__attribute__((target("avx2,bmi2")))
+static int ntuple_avx2(bitboard *board)
+{
+  int idx[NTUPLE_LANES];
+  __m256i sum = _mm256_setzero_si256(), w;
+  int t, k;
+
+  for (t = 0; t < n_tuples; t += NTUPLE_LANES) {
+    for (k = 0; k < NTUPLE_LANES; k++)
+      idx[k] = tuple_offset[t + k] + pow5[_pext_u32(board[BLACK], tuple_mask[t + k])] +
+	2 * (pow5[_pext_u32(board[WHITE], tuple_mask[t + k])] +
+	     pow5[_pext_u32(board[KING], tuple_mask[t + k])]);
+
+    /* 32 bits at each weight, the weight in the low half */
+    w = _mm256_i32gather_epi32((const int *)tuple_weights,
+			       _mm256_loadu_si256((const __m256i *)idx), 2);
+    sum = _mm256_add_epi32(sum, _mm256_srai_epi32(_mm256_slli_epi32(w, 16), 16));
+  }
+
+  sum = _mm256_add_epi32(sum, _mm256_srli_si256(sum, 8));
+  sum = _mm256_add_epi32(sum, _mm256_srli_si256(sum, 4));
+
+  return _mm256_extract_epi32(sum, 0) + _mm256_extract_epi32(sum, 4);
+}
+
+#endif
@@ -0,0 +1,558 @@
+/* importer of PDN game collections */
+
+/*
+ * Reads checkers games in PDN (portable draughts notation) and writes
+ * every position in them to a binary position file (see wdp2pos),
+ * labelled with the result of its game.  Collections of any size are
+ * read a chunk at a time, cut where a new game starts, and the chunks
+ * are parsed by a pool of threads, so only a few chunks are in memory
+ * at once.  The positions of a chunk are written together; chunks may
+ * come out in a different order than they were read.
+ *
+ * A move is found among the moves generate_moves() gives by its first
+ * and last field, and by the pieces its fields in between take if they
+ * are written.
+ * Both 11-15 and 22x15x8 (or 22x8) are understood.  The results 1-0
+ * and 2-0 are wins for black, the side that moves first; 0-1 and 0-2
+ * are wins for white; 1/2-1/2 and 1-1 are draws.  Games with an
+ * illegal move, or of another GameType than 21, are skipped whole.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "checkers.h"
+
+#define CHUNK_SIZE (1 << 20)
+#define MAX_THREADS 64
+#define MAX_QUEUE (2 * MAX_THREADS)
+
+/* text of whole games for one worker */
+struct chunk {
+  char *text;
+  int len;
+};
+
+/* chunks read and not yet parsed */
+static struct {
+  struct chunk chunk[MAX_QUEUE];
+  int head, count, size;
+  bool done;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+} queue = { .lock = PTHREAD_MUTEX_INITIALIZER,
+	    .not_empty = PTHREAD_COND_INITIALIZER,
+	    .not_full = PTHREAD_COND_INITIALIZER };
+
+/* where the positions go */
+static FILE *out;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static long n_games, n_positions, n_skipped;
+static bool write_failed;
+
+/* the positions of a chunk */
+struct records {
+  struct pos_record *rec;
+  int n, size;
+};
+
+/* a game being parsed */
+struct game {
+  bitboard board[N_BOARDS];
+  bool color;
+  int first;        /* its first record */
+  int result;       /* for black in thousandths, -1 if unknown */
+  bool moves;       /* moves seen */
+  bool bad;         /* skipped */
+  char *start;      /* its text, for error messages */
+};
+
+static void add_record(struct records *r, struct game *g)
+{
+  struct pos_record *rec;
+
+  if (r->n == r->size) {
+    r->size = r->size ? 2 * r->size : 4096;
+    r->rec = realloc(r->rec, r->size * sizeof(struct pos_record));
+  }
+  rec = &r->rec[r->n++];
+  memset(rec, 0, sizeof(*rec));
+  COPY_BOARD(rec->board, g->board);
+  rec->btm = g->color;
+}
+
+static void new_game(struct game *g, struct records *r, char *start)
+{
+  bitboard initial[N_BOARDS] = { 0xfff00000, 0x00000fff, 0 };
+
+  COPY_BOARD(g->board, initial);
+  g->color = BLACK;
+  g->first = r->n;
+  g->result = -1;
+  g->moves = FALSE;
+  g->bad = FALSE;
+  g->start = start;
+}
+
+/* labels the positions of the game with its result, or drops them */
+static void end_game(struct game *g, struct records *r, long *games, long *skipped)
+{
+  int i;
+
+  if (!g->moves && r->n == g->first)
+    return;
+
+  if (g->bad) {
+    r->n = g->first;
+    (*skipped)++;
+    return;
+  }
+
+  add_record(r, g);
+  for (i = g->first; i < r->n; i++)
+    if (g->result >= 0) {
+      r->rec[i].labels |= POS_RESULT;
+      r->rec[i].result = g->result;
+    }
+  (*games)++;
+}
+
+/* the result token str stands for, -1 if unknown, -2 if it is none */
+static int parse_result(const char *str)
+{
+  if (!strcmp(str, "1-0") || !strcmp(str, "2-0"))
+    return 1000;
+  if (!strcmp(str, "0-1") || !strcmp(str, "0-2"))
+    return 0;
+  if (!strcmp(str, "1/2-1/2") || !strcmp(str, "1-1"))
+    return 500;
+  if (!strcmp(str, "*"))
+    return -1;
+  return -2;
+}
+
+/* sets up the position of a FEN tag such as W:W18,K27:B12,16-20 */
+static bool parse_fen(struct game *g, const char *fen)
+{
+  bitboard *board = g->board;
+  int color = -1, king, from, to;
+  char *p;
+
+  board[WHITE] = board[BLACK] = board[KING] = 0;
+  while (isspace((unsigned char)*fen))
+    fen++;
+  if (*fen != 'B' && *fen != 'W')
+    return FALSE;
+  g->color = *fen++ == 'B' ? BLACK : WHITE;
+
+  while (*fen && *fen != '"') {
+    if (*fen == ':' && (fen[1] == 'B' || fen[1] == 'W')) {
+      color = fen[1] == 'B' ? BLACK : WHITE;
+      fen += 2;
+      continue;
+    }
+    if (*fen == ',' || isspace((unsigned char)*fen) || *fen == '.') {
+      fen++;
+      continue;
+    }
+    if (color < 0)
+      return FALSE;
+
+    king = *fen == 'K';
+    fen += king;
+    from = to = strtol(fen, &p, 10);
+    if (p == fen)
+      return FALSE;
+    if (*p == '-') {
+      fen = p + 1;
+      to = strtol(fen, &p, 10);
+    }
+    fen = p;
+    if (from < 1 || to > BOARD_SIZE || from > to)
+      return FALSE;
+
+    for (; from <= to; from++) {
+      board[color] |= SQUARE(from - 1);
+      if (king)
+	board[KING] |= SQUARE(from - 1);
+    }
+  }
+
+  return !(board[WHITE] & board[BLACK]);
+}
+
+/* the tag at *p, which starts with [ */
+static void parse_tag(struct game *g, char **p)
+{
+  char name[32], *value, *end;
+  int n = 0, result;
+
+  for ((*p)++; isspace((unsigned char)**p); (*p)++);
+  while (isalnum((unsigned char)**p) || **p == '_')
+    if (n < (int)sizeof(name) - 1)
+      name[n++] = *(*p)++;
+    else
+      (*p)++;
+  name[n] = 0;
+
+  value = strchr(*p, '"');
+  end = strchr(*p, ']');
+  if (!end) {
+    *p += strlen(*p);
+    return;
+  }
+
+  if (value && value < end) {
+    value++;
+    if (!strcmp(name, "FEN"))
+      g->bad |= !parse_fen(g, value);
+    else if (!strcmp(name, "GameType"))
+      g->bad |= atoi(value) != 21;
+    else if (!strcmp(name, "Result")) {
+      for (n = 0; value[n] && value[n] != '"' && n < (int)sizeof(name) - 1; n++)
+	name[n] = value[n];
+      name[n] = 0;
+      if ((result = parse_result(name)) > -2)
+	g->result = result;
+    }
+  }
+
+  *p = end + 1;
+}
+
+/* the piece taken jumping from field a to field b, 0 if that is no jump */
+static bitboard jumped(bitboard a, bitboard b)
+{
+  int i;
+
+  for (i = 0; i < N_DIRS; i++) {
+    if (DOWN_NEIGHBOR(DOWN_NEIGHBOR(a, i), i) == b)
+      return DOWN_NEIGHBOR(a, i);
+    if (UP_NEIGHBOR(UP_NEIGHBOR(a, i), i) == b)
+      return UP_NEIGHBOR(a, i);
+  }
+
+  return 0;
+}
+
+/*
+ * Makes the move written in str (fields separated by - or x), found
+ * among the legal ones, returns FALSE if there is no such move.  Only
+ * its ends need to match if it is written with two fields; written with
+ * the fields between, each step must be a jump onto an empty field, and
+ * the pieces taken must be those the move takes.
+ */
+static bool make_pdn_move(struct game *g, const char *str)
+{
+  struct move move_list[MAX_MOVES];
+  int fields[16], n_fields = 0, n, i, k, match = -1;
+  bitboard from, to, taken, over, empty;
+  const char *p = str;
+  char *end;
+
+  while (*p && n_fields < 16) {
+    fields[n_fields] = strtol(p, &end, 10);
+    if (end == p || fields[n_fields] < 1 || fields[n_fields] > BOARD_SIZE)
+      return FALSE;
+    n_fields++;
+    p = end;
+    if (*p == '-' || *p == 'x' || *p == 'X' || *p == ':')
+      p++;
+    else if (*p)
+      return FALSE;
+  }
+  if (n_fields < 2)
+    return FALSE;
+
+  /* the pieces the written path takes */
+  from = SQUARE(fields[0] - 1);
+  empty = ~(g->board[WHITE] | g->board[BLACK]) | from;
+  taken = 0;
+  for (k = 1; k < n_fields && n_fields > 2; k++) {
+    over = jumped(SQUARE(fields[k - 1] - 1), SQUARE(fields[k] - 1));
+    if (!(over & g->board[!g->color]) || (over & taken) ||
+	!(SQUARE(fields[k] - 1) & empty))
+      return FALSE;
+    taken |= over;
+  }
+
+  n = generate_moves(g->board, g->color, move_list);
+  for (i = 0; i < n; i++) {
+    from = g->board[(int)g->color] & ~move_list[i].board[(int)g->color];
+    to = move_list[i].board[(int)g->color] & ~g->board[(int)g->color];
+    if (!from)      /* a king jumping round back to its field */
+      from = to = SQUARE(fields[0] - 1) & g->board[(int)g->color];
+    if (from != SQUARE(fields[0] - 1) || to != SQUARE(fields[n_fields - 1] - 1))
+      continue;
+
+    /* jumps with the same ends are told apart by the pieces taken */
+    if (n_fields == 2 ||
+	taken == (g->board[!g->color] & ~move_list[i].board[!g->color])) {
+      match = i;
+      break;
+    }
+  }
+
+  if (match < 0)
+    return FALSE;
+
+  COPY_BOARD(g->board, move_list[match].board);
+  g->color = !g->color;
+
+  return TRUE;
+}
+
+/* parses the games in text, adds their positions to r */
+static void parse_games(char *text, struct records *r, long *games, long *skipped)
+{
+  struct game g;
+  char token[64], *p = text, *t;
+  int depth, n, result;
+
+  new_game(&g, r, p);
+
+  while (*p) {
+    if (isspace((unsigned char)*p)) {
+      p++;
+      continue;
+    }
+
+    switch (*p) {
+    case '[':
+      /* a tag after moves starts the next game */
+      if (g.moves) {
+	end_game(&g, r, games, skipped);
+	new_game(&g, r, p);
+      }
+      parse_tag(&g, &p);
+      continue;
+    case '{':
+      p = strchr(p, '}') ? strchr(p, '}') + 1 : p + strlen(p);
+      continue;
+    case ';':
+      p = strchr(p, '\n') ? strchr(p, '\n') : p + strlen(p);
+      continue;
+    case '(':
+      for (depth = 0; *p; p++)
+	if (*p == '(')
+	  depth++;
+	else if (*p == ')' && --depth == 0) {
+	  p++;
+	  break;
+	}
+      continue;
+    }
+
+    for (n = 0; *p && !isspace((unsigned char)*p) && !strchr("[{(;", *p); p++)
+      if (n < (int)sizeof(token) - 1)
+	token[n++] = *p;
+    token[n] = 0;
+
+    if ((result = parse_result(token)) > -2) {
+      if (result >= 0)
+	g.result = result;
+      end_game(&g, r, games, skipped);
+      new_game(&g, r, p);
+      continue;
+    }
+
+    /* move numbers, annotations and NAGs */
+    if ((t = strrchr(token, '.')))
+      memmove(token, t + 1, strlen(t));
+    for (n = strlen(token); n > 0 && strchr("!?", token[n - 1]); n--)
+      token[n - 1] = 0;
+    if (!token[0] || token[0] == '$' || g.bad)
+      continue;
+
+    add_record(r, &g);
+    if (!make_pdn_move(&g, token)) {
+      for (t = g.start; isspace((unsigned char)*t); t++);
+      fprintf(stderr, "illegal move %s in the game starting: %.40s\n", token, t);
+      r->n--;
+      g.bad = TRUE;
+    }
+    g.moves = TRUE;
+  }
+
+  end_game(&g, r, games, skipped);
+}
+
+static void *worker(void *arg)
+{
+  struct records r = { NULL, 0, 0 };
+  struct chunk chunk;
+  long games, skipped;
+
+  for (;;) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0 && !queue.done)
+      pthread_cond_wait(&queue.not_empty, &queue.lock);
+    if (queue.count == 0) {
+      pthread_mutex_unlock(&queue.lock);
+      break;
+    }
+    chunk = queue.chunk[queue.head];
+    queue.head = (queue.head + 1) % queue.size;
+    queue.count--;
+    pthread_cond_signal(&queue.not_full);
+    pthread_mutex_unlock(&queue.lock);
+
+    r.n = 0;
+    games = skipped = 0;
+    parse_games(chunk.text, &r, &games, &skipped);
+    free(chunk.text);
+
+    pthread_mutex_lock(&out_lock);
+    if (r.n && fwrite(r.rec, sizeof(struct pos_record), r.n, out) != (size_t)r.n)
+      write_failed = TRUE;
+    n_positions += r.n;
+    n_games += games;
+    n_skipped += skipped;
+    pthread_mutex_unlock(&out_lock);
+  }
+
+  free(r.rec);
+
+  return NULL;
+}
+
+static void put_chunk(char *text, int len)
+{
+  pthread_mutex_lock(&queue.lock);
+  while (queue.count == queue.size)
+    pthread_cond_wait(&queue.not_full, &queue.lock);
+  queue.chunk[(queue.head + queue.count) % queue.size].text = text;
+  queue.chunk[(queue.head + queue.count) % queue.size].len = len;
+  queue.count++;
+  pthread_cond_signal(&queue.not_empty);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+/*
+ * Where the last game in buf starts: a line with a tag after a line
+ * with something else.  0 if there is none.
+ */
+static int last_game(const char *buf, int len)
+{
+  int i, j, k;
+
+  for (i = len - 1; i > 0; i--) {
+    if (buf[i] != '[' || buf[i - 1] != '\n')
+      continue;
+
+    /* the line before, blank lines skipped */
+    for (j = i - 1; j > 0 && isspace((unsigned char)buf[j - 1]); j--);
+    for (k = j; k > 0 && buf[k - 1] != '\n'; k--);
+    if (j > 0 && buf[k] != '[')
+      return i;
+  }
+
+  return 0;
+}
+
+/* reads file in chunks of whole games and queues them */
+static bool read_pdn(char *file)
+{
+  char *buf, *rest;
+  int size = CHUNK_SIZE, len = 0, n, cut;
+  FILE *fd;
+
+  fd = strcmp(file, "-") ? fopen(file, "r") : stdin;
+  if (fd == NULL) {
+    perror(file);
+    return FALSE;
+  }
+
+  buf = malloc(size + 1);
+  while ((n = fread(buf + len, 1, size - len, fd)) > 0) {
+    len += n;
+    if (len < size)
+      continue;
+
+    /* a chunk without a second game grows until it has one */
+    if ((cut = last_game(buf, len)) == 0) {
+      size *= 2;
+      buf = realloc(buf, size + 1);
+      continue;
+    }
+
+    rest = malloc(MAX(size, CHUNK_SIZE) + 1);
+    memcpy(rest, buf + cut, len - cut);
+    buf[cut] = 0;
+    put_chunk(buf, cut);
+    buf = rest;
+    len -= cut;
+  }
+
+  if (ferror(fd))
+    perror(file);
+  if (fd != stdin)
+    fclose(fd);
+
+  buf[len] = 0;
+  put_chunk(buf, len);
+
+  return TRUE;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ./pdn2pos [-j threads] out-file pdn-files...\n");
+  fprintf(stderr, "          -j  Threads to parse with (all cores)\n");
+  fprintf(stderr, "       A pdn-file may be - for standard input.\n");
+}
+
+int main(int argc, char *argv[])
+{
+  pthread_t thread[MAX_THREADS];
+  int c, i, n_threads;
+  bool ok = TRUE;
+
+  n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((c = getopt(argc, argv, "j:")) != -1)
+    switch (c) {
+    case 'j':
+      n_threads = atoi(optarg);
+      break;
+    default:
+      usage();
+      return 1;
+    }
+
+  if (argc - optind < 2) {
+    usage();
+    return 1;
+  }
+  n_threads = MIN(MAX(n_threads, 1), MAX_THREADS);
+  queue.size = 2 * n_threads;
+
+  if ((out = pos_create(argv[optind])) == NULL)
+    return 1;
+
+  for (i = 0; i < n_threads; i++)
+    pthread_create(&thread[i], NULL, worker, NULL);
+
+  for (i = optind + 1; i < argc; i++)
+    ok &= read_pdn(argv[i]);
+
+  pthread_mutex_lock(&queue.lock);
+  queue.done = TRUE;
+  pthread_cond_broadcast(&queue.not_empty);
+  pthread_mutex_unlock(&queue.lock);
+
+  for (i = 0; i < n_threads; i++)
+    pthread_join(thread[i], NULL);
+
+  if (fclose(out) != 0 || write_failed) {
+    perror(argv[optind]);
+    return 1;
+  }
+  fprintf(stderr, "%ld games, %ld positions written to %s, %ld games skipped\n",
+	  n_games, n_positions, argv[optind], n_skipped);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,263 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "checkers.h"
+
+/*
+ * Line based engine protocol (./checkers --protocol)
+ *
+ * For programs driving the engine, instead of the operator prompts.
+ * Nothing but the replies below is printed.  Commands, one per line:
+ *
+ *   position startpos|wdp <file>|<32 fields> <b|w> [moves <move>...]
+ *                 the fields as in a .wdp file, moves as 11-15 or 15x24
+ *   go [movetime <ms>] [depth <n>] [nodes <n>] [ponder] [infinite]
+ *                 search the position; without limits until stop
+ *   stop          answer now with the best move so far
+ *   ponderhit     the pondered move was played, the clock starts
+ *   isready       answered by readyok once earlier commands are done
+ *   quit
+ *
+ * A search runs in a thread of its own, so that stop and ponderhit are
+ * read while it runs.  It reports each completed depth as
+ *
+ *   info depth <n> score <val> nodes <n> time <ms> pv <move>
+ *
+ * with val for the side to move, and answers with bestmove <move>, or
+ * bestmove none without a move.  Errors are reported as info string.
+ * The server (server.c) speaks the same protocol over its sockets.
+ */
+
+/* wakes searches waiting for stop or ponderhit */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+/* the game of the search running in this thread, for info() */
+static __thread struct session *info_session;
+
+static void info(int depth, int val, int nodes, int msecs, const struct move *best)
+{
+  struct session *g = info_session;
+  char buf[128];
+
+  trans_move_string(g->board, (struct move *)best, buf, g->btm);
+  fprintf(g->out, "info depth %d score %d nodes %d time %d pv %s\n",
+	  depth, val, nodes, msecs, buf);
+  fflush(g->out);
+}
+
+/** Whether line is the command */
+bool protocol_is(const char *line, const char *command)
+{
+  int n = strlen(command);
+
+  return !strncmp(line, command, n) &&
+    (line[n] == 0 || line[n] == ' ' || line[n] == '\t');
+}
+
+/**
+ * Sets the position of the game from the arguments of a position
+ * command.
+ *
+ * \return FALSE if they are not a position, which is reported
+ */
+bool session_position(struct session *g, char *args)
+{
+  bitboard board[N_BOARDS];
+  struct move move;
+  bool color;
+  double time_left;
+  char *moves, *p, *file;
+
+  if ((moves = strstr(args, "moves")) != NULL)
+    *moves = 0;
+
+  if (strncmp(args, "startpos", 8) == 0) {
+    board[BLACK] = 0x00000fff;
+    board[WHITE] = 0xfff00000;
+    board[KING] = 0;
+    color = BLACK;
+  }
+  else if (strncmp(args, "wdp", 3) == 0) {
+    file = strtok(args + 3, " \t\n");
+    if (file == NULL || !read_wdp(board, file, &color, &time_left)) {
+      fprintf(g->out, "info string cannot read %s\n", file ? file : "(no file)");
+      return FALSE;
+    }
+  }
+  else if (parse_position(args, board, &color) == NULL) {
+    fprintf(g->out, "info string bad position: %s\n", args);
+    return FALSE;
+  }
+
+  if (moves)
+    for (p = strtok(moves + 5, " \t\n"); p; p = strtok(NULL, " \t\n")) {
+      if (!find_move(board, color, p, &move)) {
+	fprintf(g->out, "info string illegal move %s\n", p);
+	return FALSE;
+      }
+      COPY_BOARD(board, move.board);
+      color = !color;
+    }
+
+  COPY_BOARD(g->board, board);
+  g->btm = color;
+
+  return TRUE;
+}
+
+/**
+ * Sets the limits of the game's next search from the arguments of a go
+ * command.
+ *
+ * \param movetime The milliseconds for a go without limits, 0 to search
+ *        until stop
+ * \return Whether to search; FALSE for bad arguments, which are
+ *         reported, or when there is no move, which is answered
+ */
+bool session_go(struct session *g, char *args, int movetime)
+{
+  char *p;
+
+  memset(&g->limits, 0, sizeof(g->limits));
+  g->limits.info = info;
+  g->infinite = FALSE;
+
+  for (p = strtok(args, " \t\n"); p; p = strtok(NULL, " \t\n"))
+    if (!strcmp(p, "ponder"))
+      g->limits.ponder = TRUE;
+    else if (!strcmp(p, "infinite"))
+      g->infinite = TRUE;
+    else if (!strcmp(p, "movetime") && (p = strtok(NULL, " \t\n")))
+      g->limits.movetime = atoi(p);
+    else if (!strcmp(p, "depth") && (p = strtok(NULL, " \t\n")))
+      g->limits.depth = atoi(p);
+    else if (!strcmp(p, "nodes") && (p = strtok(NULL, " \t\n")))
+      g->limits.nodes = atoi(p);
+    else {
+      fprintf(g->out, "info string bad go argument %s\n", p);
+      return FALSE;
+    }
+  if (!g->infinite && !g->limits.movetime && !g->limits.depth && !g->limits.nodes) {
+    g->limits.movetime = movetime;
+    g->infinite = movetime == 0;
+  }
+
+  if (count_moves(g->board, g->btm) == 0) {
+    fprintf(g->out, "bestmove none\n");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * Searches the game's position within its limits and answers with the
+ * best move.  An infinite or pondering search is not answered before
+ * session_tell() sets stop or ponderhit.
+ */
+void session_search(struct session *g)
+{
+  struct move best;
+  char buf[128];
+
+  info_session = g;
+  mtdf_limited(g->board, &best, g->btm, &g->limits);
+
+  pthread_mutex_lock(&lock);
+  while (!g->limits.stop && (g->infinite || (g->limits.ponder && !g->limits.ponderhit)))
+    pthread_cond_wait(&wake, &lock);
+  pthread_mutex_unlock(&lock);
+
+  trans_move_string(g->board, &best, buf, g->btm);
+  fprintf(g->out, "bestmove %s\n", buf);
+  fflush(g->out);
+}
+
+/** Sets flag, stop or ponderhit of a game's limits, for its search to see */
+void session_tell(struct session *g, volatile bool *flag)
+{
+  pthread_mutex_lock(&lock);
+  *flag = TRUE;
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&lock);
+}
+
+/* the game on standard input and output, and its search */
+static struct session game;
+static bool searching;
+static pthread_t search_id;
+
+static void *search_thread(void *arg)
+{
+  session_search(&game);
+  search_free();
+
+  return NULL;
+}
+
+/* stops the search if there is one and waits for its answer */
+static void end_search()
+{
+  if (!searching)
+    return;
+  session_tell(&game, &game.limits.stop);
+  pthread_join(search_id, NULL);
+  searching = FALSE;
+}
+
+/**
+ * Reads commands from standard input until quit or the end of it.
+ *
+ * \return The exit code for main()
+ */
+int protocol_loop()
+{
+  char *line = NULL, *args;
+  char start[] = "startpos";
+  size_t size = 0;
+
+  game.out = stdout;
+  session_position(&game, start);
+
+  /* lines of any length, a position with many moves may be long */
+  while (getline(&line, &size, stdin) > 0) {
+    line[strcspn(line, "\r\n")] = 0;
+    args = line + strcspn(line, " \t");
+    args += strspn(args, " \t");
+
+    if (protocol_is(line, "position")) {
+      end_search();
+      session_position(&game, args);
+    }
+    else if (protocol_is(line, "go")) {
+      end_search();
+      if (session_go(&game, args, 0)) {
+	if (pthread_create(&search_id, NULL, search_thread, NULL) == 0)
+	  searching = TRUE;
+	else
+	  printf("info string cannot start the search\n");
+      }
+    }
+    else if (protocol_is(line, "stop"))
+      end_search();
+    else if (protocol_is(line, "ponderhit")) {
+      if (searching)
+	session_tell(&game, &game.limits.ponderhit);
+    }
+    else if (protocol_is(line, "isready"))
+      printf("readyok\n");
+    else if (protocol_is(line, "quit"))
+      break;
+    else if (line[0])
+      printf("info string unknown command %s\n", line);
+    fflush(stdout);
+  }
+
+  end_search();
+  free(line);
+
+  return 0;
+}
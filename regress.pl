@@ -0,0 +1,124 @@
+#!/usr/bin/perl -w
+#
+# Performance regression test of a build against a reference build
+#
+# Searches the same positions to a fixed depth with both programs through
+# the line based protocol (see protocol.c), and reports the nodes, the
+# time to the depth and the nodes per second of each, the positions
+# where the node counts differ, and the totals.  Then plays a short match
+# between the two with ./match.
+#
+# The reference is usually a copy make ref saved in ref/.  It must know
+# --protocol, which the builds before it did not.
+
+use FileHandle;
+use IPC::Open2;
+use Getopt::Std;
+
+sub usage {
+    print "Usage: ./regress.pl [-d depth] [-n games] [-j workers] [-m match-depth]\n";
+    print "                    [-p positions] ref-program [program]\n";
+    print "       Defaults: depth 12, 8 games on 2 workers at depth 6, the\n";
+    print "       positions starts/*.wdp and the program ./checkers.\n";
+    print "       -n 0 leaves out the match.\n";
+    exit 1;
+}
+
+my %opt;
+getopts('d:n:j:m:p:', \%opt) or usage;
+usage if ($#ARGV < 0 || $#ARGV > 1);
+
+my $depth = $opt{'d'} || 12;
+my $games = defined $opt{'n'} ? $opt{'n'} : 8;
+my $workers = $opt{'j'} || 2;
+my $match_depth = $opt{'m'} || 6;
+my @positions = glob($opt{'p'} || "starts/*.wdp");
+my $ref = $ARGV[0];
+my $new = $ARGV[1] || "./checkers";
+
+$SIG{'PIPE'} = 'IGNORE';
+
+# searches every position with a program, returns a hash of the results
+# by position: [depth reached, nodes, milliseconds]
+sub search_all {
+    my $prog = shift;
+    my (%result, $in, $out, $pid);
+
+    $pid = open2($in, $out, $prog, "--protocol")
+	or die "cannot run $prog\n";
+    $out->autoflush();
+    print $out "isready\n";
+    while (<$in>) { last if (/^readyok/); }
+    die "$prog does not speak --protocol (see protocol.c)\n" if (!defined $_);
+
+    foreach my $pos (@positions) {
+	my ($d, $nodes, $ms) = (0, 0, 0);
+
+	print $out "position wdp $pos\ngo depth $depth\n";
+	while (<$in>) {
+	    ($d, $nodes, $ms) = ($1, $2, $3)
+		if (/^info depth (\d+) score \S+ nodes (\d+) time (\d+)/);
+	    last if (/^bestmove/);
+	    print STDERR "$prog, $pos: $_" if (/^info string/);
+	}
+	die "$prog ended during $pos\n" if (!defined $_);
+	$result{$pos} = [$d, $nodes, $ms];
+    }
+    print $out "quit\n";
+    close($out);
+    waitpid($pid, 0);
+
+    return \%result;
+}
+
+sub delta {
+    my ($new, $old) = @_;
+    return $old ? sprintf("%+.1f%%", 100 * ($new - $old) / $old) : "-";
+}
+
+my $ref_result = search_all($ref);
+my $new_result = search_all($new);
+my (@differ, $ref_nodes, $new_nodes, $ref_ms, $new_ms);
+$ref_nodes = $new_nodes = $ref_ms = $new_ms = 0;
+
+print "Depth $depth, $new against $ref:\n\n";
+printf("%-24s %5s %11s %11s %8s %8s %8s\n", "position", "depth",
+       "nodes", "ref nodes", "ms", "ref ms", "time");
+foreach my $pos (@positions) {
+    my ($nd, $nn, $nt) = @{$new_result->{$pos}};
+    my ($rd, $rn, $rt) = @{$ref_result->{$pos}};
+    my $name = $pos;
+
+    $name =~ s/.*\///;
+    printf("%-24s %5s %11d %11d %8d %8d %8s%s\n", $name,
+	   $nd == $rd ? $nd : "$nd/$rd", $nn, $rn, $nt, $rt, delta($nt, $rt),
+	   $nn != $rn || $nd != $rd ? "  *" : "");
+    push(@differ, $name) if ($nn != $rn || $nd != $rd);
+    $new_nodes += $nn; $ref_nodes += $rn;
+    $new_ms += $nt; $ref_ms += $rt;
+}
+
+print "\n";
+printf("Time to depth %d: %d ms, ref %d ms (%s)\n", $depth, $new_ms, $ref_ms,
+       delta($new_ms, $ref_ms));
+printf("Nodes per second: %.0f, ref %.0f (%s)\n",
+       $new_ms ? 1000 * $new_nodes / $new_ms : 0,
+       $ref_ms ? 1000 * $ref_nodes / $ref_ms : 0,
+       delta($new_ms ? $new_nodes / $new_ms : 0, $ref_ms ? $ref_nodes / $ref_ms : 0));
+if (@differ) {
+    printf("Node counts differ (*) in %d positions: %s\n", scalar(@differ),
+	   join(" ", @differ));
+}
+else {
+    print "Node counts are the same in all positions.\n";
+}
+
+exit 0 if ($games == 0);
+
+print "\nMatch, $games games at depth $match_depth on $workers workers:\n";
+open(MATCH, "./match -j $workers -n $games -d $match_depth $new $ref 2>&1 |")
+    or die "cannot run ./match\n";
+my $last = "";
+while (<MATCH>) { $last = $_; }
+close(MATCH);
+print $last;
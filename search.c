@@ -6,42 +6,251 @@
 #include <time.h>
 #include <signal.h>
 #include <setjmp.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include "checkers.h"
 
+/*
+ * Searches may run in several threads at once (see server.c), so all
+ * their state is per thread but the transposition table.
+ */
+
 /* global variables for search parameters */
-static int n_evals, n_nodes, n_hash, top_depth;
-static int time_allowed;
+static __thread int n_evals, n_eval_hits, n_lazy, n_nodes, n_hash, top_depth;
+static __thread int time_allowed;
+static __thread int done_depth, done_val;   /* last iteration completed */
+
+/* limits of mtdf_limited(), NULL in mtdf(); checked every 1024 nodes */
+static __thread const struct search_limits *limits;
+static __thread struct timespec start_time;
+static __thread bool clock_on, aborted;
+
+/* in mtdf(), whose alarm may cut the search short anywhere */
+static __thread bool alarm_on;
 
 /* best move found so far */
-static struct move *best_move_p;
+static __thread struct move *best_move_p;
 
-/* transposition table */
+/* transposition table, shared by all threads */
 static struct hash_pos *trans_table;
 
+/* eval cache */
+#if EVAL_CACHE_SIZE > 0
+static __thread struct eval_pos *eval_cache;
+#endif
+
 /* should be set in main.o or test.o */
 extern jmp_buf env;
 extern sigset_t alarm_set;
 
+/* men structure cache counters, in eval.o */
+extern __thread int n_men_lookups, n_men_hits;
+
+static void print_stats()
+{
+  printf("Completed %d depths, %d nodes, %d evals (%d lazy), %d hash hits, %.1lf%% eval cache hits, %.1lf%% men cache hits (%.02lf eval/sec)\n", 
+	 top_depth - 1, n_nodes, n_evals, n_lazy, n_hash,
+	 n_evals + n_eval_hits ? 100.0 * n_eval_hits / (n_evals + n_eval_hits) : 0.0,
+	 n_men_lookups ? 100.0 * n_men_hits / n_men_lookups : 0.0,
+	 (double)n_evals/time_allowed);
+}
+
+/**
+ * What the last mtdf() found: the depths it completed, the nodes it
+ * searched and the value of the last completed depth, black positive.
+ */
+void search_stats(int *depth, int *nodes, int *score)
+{
+  *depth = done_depth;
+  *nodes = n_nodes;
+  *score = done_val;
+}
+
+/* milliseconds since start_time */
+static int msecs_used()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start_time.tv_sec) * 1000 +
+    (now.tv_nsec - start_time.tv_nsec) / 1000000;
+}
+
+/*
+ * Only mtdf() has the alarm to block, mtdf_limited() is never
+ * interrupted and may run in threads that did not set up alarm_set.
+ */
+static void block_alarm()
+{
+  if (alarm_on)
+    pthread_sigmask(SIG_BLOCK, &alarm_set, NULL);
+}
+
+static void unblock_alarm()
+{
+  if (alarm_on)
+    pthread_sigmask(SIG_UNBLOCK, &alarm_set, NULL);
+}
+
+/*
+ * Check word of a transposition table entry.  An entry may be read
+ * while another thread writes it, or be left half written by the
+ * alarm; one that does not match its check word is taken as a miss.
+ */
+static bitboard hash_check(const struct hash_pos *e)
+{
+  return e->board[WHITE] ^ e->board[BLACK] ^ e->board[KING] ^
+    e->best_move.captured ^ (bitboard)e->high_bound ^
+    ((bitboard)e->low_bound << 16 | (bitboard)e->low_bound >> 16) ^
+    (e->high_depth | e->low_depth << 8 | e->best_move.from << 16 |
+     e->best_move.to << 24) ^
+    (e->color << 5 | e->has_best_move << 6 | e->best_move.promote << 7);
+}
+
+/**
+ * Copies the transposition table entry at hash_key to entry.
+ *
+ * \return Whether it is the entry of board with color to move
+ */
+bool trans_probe(bitboard *board, const bool color, int hash_key,
+		 struct hash_pos *entry)
+{
+  *entry = trans_table[hash_key];
+
+  return board[WHITE] == entry->board[WHITE] &&
+    board[BLACK] == entry->board[BLACK] &&
+    board[KING] == entry->board[KING] &&
+    color == entry->color && entry->check == hash_check(entry);
+}
+
+/** Stores entry at hash_key in the transposition table, with its check word */
+void trans_store(int hash_key, struct hash_pos *entry)
+{
+  entry->check = hash_check(entry);
+  trans_table[hash_key] = *entry;
+}
+
+/*
+ * Sets aborted if the search is out of limits.  The clock of a
+ * pondering search starts when ponderhit is set.
+ */
+static bool check_limits()
+{
+  if (limits->stop || (limits->nodes && n_nodes >= limits->nodes))
+    aborted = TRUE;
+  else if (!clock_on) {
+    if (limits->ponderhit) {
+      clock_gettime(CLOCK_MONOTONIC, &start_time);
+      clock_on = TRUE;
+    }
+  }
+  else if (limits->movetime && msecs_used() >= limits->movetime)
+    aborted = TRUE;
+
+  return aborted;
+}
+
 void alarm_handler(int signal)
 {
-  printf("Completed %d depths, %d nodes, %d evals, %d hash hits (%.02lf eval/sec)\n", 
-	 top_depth - 1, n_nodes, n_evals, n_hash, (double)n_evals/time_allowed);
+  print_stats();
 
+  /* the longjmp() skips the end of mtdf(), which clears it otherwise */
+  alarm_on = FALSE;
   longjmp(env, 1);
 }
 
-/* alpha beta function "with memory */
-int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color)
+/*
+ * Check word of an eval cache entry; one left half written by the alarm
+ * does not match it and is taken as a miss.
+ */
+static bitboard eval_check(const struct eval_pos *e)
+{
+  return e->board[WHITE] ^ (e->board[BLACK] << 8 | e->board[BLACK] >> 24) ^
+    (e->board[KING] << 16 | e->board[KING] >> 16) ^ (bitboard)e->val ^
+    (bitboard)e->btm << 31;
+}
+
+/*
+ * eval() (or ntuple_eval() if ntuple_on) from the side to move's point
+ * of view, looked up in the eval cache first.  Otherwise eval() is
+ * computed lazily for the window (alpha, beta), and only exact values
+ * are stored.
+ */
+static int cached_eval(bitboard *board, const struct eval_acc *acc,
+		       int alpha, int beta, const bool color)
+{
+  bool exact;
+  int val;
+#if EVAL_CACHE_SIZE > 0
+  struct eval_pos *entry = &eval_cache[HASH_KEY(board) % EVAL_CACHE_SIZE];
+
+  if (entry->board[BLACK] == board[BLACK] &&
+      entry->board[WHITE] == board[WHITE] &&
+      entry->board[KING] == board[KING] &&
+      entry->btm == color && entry->check == eval_check(entry)) {
+    n_eval_hits++;
+    return color ? entry->val : -entry->val;
+  }
+#endif
+
+  n_evals++;
+  if (ntuple_on) {
+    val = color ? ntuple_eval(board, BLACK) : -ntuple_eval(board, WHITE);
+    exact = TRUE;
+  }
+  else if (color)
+    val = eval_lazy(board, BLACK, acc, alpha, beta, &exact);
+  else
+    val = -eval_lazy(board, WHITE, acc, -beta, -alpha, &exact);
+
+  if (!exact) {
+    n_lazy++;
+    return val;
+  }
+
+#if EVAL_CACHE_SIZE > 0
+  COPY_BOARD(entry->board, board);
+  entry->btm = color;
+  entry->val = color ? val : -val;
+  entry->check = eval_check(entry);
+#endif
+
+  return val;
+}
+
+/* 
+ * Sets the global best move to delta played from the root position
+ * board.  Must only be called with the alarm blocked.
+ */
+static void set_best_move(bitboard *board, const struct delta *delta, 
+			  const bool color)
+{
+  COPY_BOARD(best_move_p->board, board);
+  make_move(best_move_p->board, delta, color);
+}
+
+/* 
+ * alpha beta function "with memory".  Moves are made and taken back on
+ * board itself, so it is unchanged when the function returns normally.
+ * acc holds the local eval terms of board; each child gets its own copy,
+ * updated from the move, so there is nothing to take back.
+ */
+int alpha_beta(bitboard *board, const struct eval_acc *acc, int alpha, int beta,
+	       int depth, const bool color)
 {
   int val, next_val, best_alpha, n_moves, i;
   int hash_key;
-  struct move move_list[MAX_MOVES];
-  struct move best_move;
-  struct hash_pos *hash_entry;
+  struct delta move_list[MAX_MOVES];
+  struct delta best_move;
+  struct hash_pos *hash_entry, entry;
+  struct eval_acc next_acc;
+  bitboard cap_kings;
   bool has_best_move = FALSE;
 
   n_nodes++;
+  /* an aborted search unwinds with any value, it is never used */
+  if (limits && (n_nodes & 1023) == 0 && check_limits())
+    return 0;
 
 #ifdef DEBUG 
   printf("SEARCH: depth = %d, alpha = %d, beta = %d\n", depth, alpha, beta);
@@ -51,14 +260,7 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
   
   /* get the appropriate hash_pos */
   hash_key = HASH_KEY(board) % TRANS_TABLE_SIZE;
-  hash_entry = &trans_table[hash_key];
-
-  if (board[WHITE] != hash_entry->board[WHITE] ||
-      board[BLACK] != hash_entry->board[BLACK] ||
-      board[KING] != hash_entry->board[KING] ||
-      color != hash_entry->color) {
-    hash_entry = NULL;
-  }
+  hash_entry = trans_probe(board, color, hash_key, &entry) ? &entry : NULL;
 
   if (hash_entry) {
     n_hash++;
@@ -72,12 +274,12 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
 #endif
     if (hash_entry->low_depth >= depth) {
       if (hash_entry->low_bound >= beta) {
-	if (depth == top_depth) {
+	if (depth == top_depth && hash_entry->has_best_move) {
 #ifdef DEBUG
-	  printf("SEARCH: Setting GLOBAL Best move to:\n");
-	  print_board(best_move.board);
+	  printf("SEARCH: Setting GLOBAL Best move to %d-%d\n",
+		 hash_entry->best_move.from + 1, hash_entry->best_move.to + 1);
 #endif
-	  COPY_BOARD(best_move_p->board, hash_entry->best_move.board);
+	  set_best_move(board, &hash_entry->best_move, color);
 	}
 
 	return hash_entry->low_bound;
@@ -89,12 +291,12 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
     
     if (hash_entry->high_depth >= depth) {
       if (hash_entry->high_bound <= alpha) {
-	if (depth == top_depth) {
+	if (depth == top_depth && hash_entry->has_best_move) {
 #ifdef DEBUG
-	  printf("SEARCH: Setting GLOBAL Best move to:\n");
-	  print_board(best_move.board);
+	  printf("SEARCH: Setting GLOBAL Best move to %d-%d\n",
+		 hash_entry->best_move.from + 1, hash_entry->best_move.to + 1);
 #endif
-	  COPY_BOARD(best_move_p->board, hash_entry->best_move.board);
+	  set_best_move(board, &hash_entry->best_move, color);
 	}
 
 	return hash_entry->high_bound;
@@ -106,10 +308,8 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
   }
 
 
-  if (depth == 0) {
-    n_evals++;
-    val = color ? eval(board, BLACK) : -eval(board, WHITE);
-  }
+  if (depth == 0)
+    val = cached_eval(board, acc, alpha, beta, color);
   else {
     val = -INFINITY;
     best_alpha = alpha;
@@ -119,25 +319,30 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
 #ifdef DEBUG 
       printf("SEARCH: Using best move from hash table\n");
 #endif
-      COPY_BOARD(best_move.board, hash_entry->best_move.board);
+      best_move = hash_entry->best_move;
       has_best_move = TRUE;
 
-      val = -alpha_beta(hash_entry->best_move.board, -beta, -alpha, depth - 1, !color);
+      eval_acc_move(acc, board, &best_move, color, &next_acc);
+      cap_kings = make_move(board, &best_move, color);
+      val = -alpha_beta(board, &next_acc, -beta, -alpha, depth - 1, !color);
+      unmake_move(board, &best_move, color, cap_kings);
+      if (aborted)
+	return 0;
       if (val > best_alpha) {
 	best_alpha = val;
 	if (depth == top_depth) {
-	  sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+	  block_alarm();
 #ifdef DEBUG
-	  printf("SEARCH: Setting GLOBAL Best move to:\n");
-	  print_board(best_move.board);
+	  printf("SEARCH: Setting GLOBAL Best move to %d-%d\n",
+		 best_move.from + 1, best_move.to + 1);
 #endif
-	  COPY_BOARD(best_move_p->board, best_move.board);
-	  sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+	  set_best_move(board, &best_move, color);
+	  unblock_alarm();
 	}
       }
     }
 
-    n_moves = generate_moves(board, color, move_list);
+    n_moves = generate_deltas(board, color, move_list);
 
     /* no moves? we lose! */
     /* what to do here 
@@ -149,46 +354,51 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
     printf("SEARCH: Going into move search, val = %d, beta = %d\n", val, beta);
 #endif
     for (i = 0; i < n_moves && val < beta; i++) {
-      next_val = -alpha_beta(move_list[i].board, -beta, -best_alpha, depth - 1, !color);
+      eval_acc_move(acc, board, &move_list[i], color, &next_acc);
+      cap_kings = make_move(board, &move_list[i], color);
+      next_val = -alpha_beta(board, &next_acc, -beta, -best_alpha, depth - 1, !color);
+      unmake_move(board, &move_list[i], color, cap_kings);
+      if (aborted)
+	return 0;
       if (next_val > val) {
 	val = next_val;
-	COPY_BOARD(best_move.board, move_list[i].board);
+	best_move = move_list[i];
 	has_best_move = TRUE;
       }
       if (next_val > best_alpha) {
 	best_alpha = next_val;
 	if (depth == top_depth) {
-	  sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+	  block_alarm();
 #ifdef DEBUG
-	  printf("SEARCH: Setting GLOBAL Best move to:\n");
-	  print_board(move_list[i].board);
+	  printf("SEARCH: Setting GLOBAL Best move to %d-%d\n",
+		 move_list[i].from + 1, move_list[i].to + 1);
 #endif
 
-	  COPY_BOARD(best_move_p->board, move_list[i].board);
-	  sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+	  set_best_move(board, &move_list[i], color);
+	  unblock_alarm();
 	}
       }
     }
   }
 
-  hash_entry = &trans_table[hash_key];
-
-  sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+  /*
+   * The entry is made here and copied, so its check word is its own;
+   * a copy the alarm cuts short does not match it.
+   */
+  hash_entry = &entry;
 #ifdef DEBUG
   printf("Storing hash (%08x) at level %d (%s) for position:\n", 
 	 hash_key, depth, color ? "black" : "white");
   print_board(board);
-  if (has_best_move) {
-    printf("Best move:\n");
-    print_board(best_move.board);
-  }
+  if (has_best_move)
+    printf("Best move: %d-%d\n", best_move.from + 1, best_move.to + 1);
   printf("val = %d [%d, %d]\n", val, alpha, beta);
 #endif
 
   hash_entry->color = color;
   hash_entry->has_best_move = has_best_move;
   COPY_BOARD(hash_entry->board, board);
-  COPY_BOARD(hash_entry->best_move.board, best_move.board); 
+  hash_entry->best_move = best_move;
 
   if (val <= alpha) {
     hash_entry->high_bound = val;
@@ -208,29 +418,118 @@ int alpha_beta(bitboard *board, int alpha, int beta, int depth, const bool color
     hash_entry->low_bound = val;
     hash_entry->low_depth = depth;
   }
-  sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+  trans_store(hash_key, hash_entry);
   
   return val;
 }
 
-void mtdf(bitboard *board, struct move *best_move, 
-	  const bool color, unsigned int time_s)
+/**
+ * Allocates the transposition table, which searches otherwise do when
+ * they first need it.  Threads that search at the same time must have
+ * it allocated before they start.
+ */
+void search_tables(void)
 {
-  int i, val, beta, lower_bound, upper_bound;
-
-  /* initialize transposition table, if necessary */
   if (trans_table == NULL) {
     trans_table = (struct hash_pos *)malloc(sizeof(struct hash_pos) * TRANS_TABLE_SIZE);
     memset(trans_table, 0, sizeof(struct hash_pos) * TRANS_TABLE_SIZE);
   }
+}
+
+/** Frees the eval caches of the calling thread, a thread that is done searching */
+void search_free(void)
+{
+#if EVAL_CACHE_SIZE > 0
+  free(eval_cache);
+  eval_cache = NULL;
+#endif
+  eval_free();
+}
+
+/*
+ * Allocates the tables on first use and resets the counters.  The best
+ * move starts as the first legal one: when the transposition table
+ * narrows the root window, no root move may beat alpha at a depth.
+ */
+static void search_init(bitboard *board, struct move *best_move, const bool color)
+{
+  struct move move_list[MAX_MOVES];
+
+  search_tables();
+#if EVAL_CACHE_SIZE > 0
+  if (eval_cache == NULL)
+    eval_cache = (struct eval_pos *)calloc(EVAL_CACHE_SIZE, sizeof(struct eval_pos));
+#endif
 
   /* initialize global variables */
-  n_evals = n_nodes = n_hash = 0;
+  n_evals = n_eval_hits = n_lazy = n_nodes = n_hash = 0;
+  n_men_lookups = n_men_hits = 0;
   best_move_p = best_move;
+  if (generate_moves(board, color, move_list) > 0)
+    *best_move = move_list[0];
+}
+
+/* 
+ * Searches root to depth with MTD(f), starting from the guess val
+ * (the value of the depth before), and returns its value.
+ */
+static int mtdf_depth(bitboard *root, const struct eval_acc *root_acc,
+		      int depth, int val, const bool color)
+{
+  int beta, lower_bound, upper_bound;
+
+  top_depth = depth;
+#ifdef DEBUG
+  printf("SEARCH: Searching to depth %d\n", depth);
+#endif
+    
+  upper_bound = INFINITY;
+  lower_bound = -INFINITY;
+
+  while (upper_bound > lower_bound) {
+    if (val == lower_bound)
+      beta = val + 1;
+    else 
+      beta = val;
+
+    val = alpha_beta(root, root_acc, beta - 1, beta, depth, color);
+    if (aborted)
+      break;
+#ifdef DEBUG
+    printf("SEARCH: alpha_beta return, val = %d, beta = %d, [%d, %d]\n", 
+	   val, beta, lower_bound, upper_bound);
+#endif
+      
+    if (val < beta)
+      upper_bound = val;
+    else 
+      lower_bound = val;
+  }
+
+  return val;
+}
+
+void mtdf(bitboard *board, struct move *best_move, 
+	  const bool color, unsigned int time_s)
+{
+  int i, val;
+  bitboard root[N_BOARDS];
+  struct eval_acc root_acc;
+
+  search_init(board, best_move, color);
+  limits = NULL;
+  aborted = FALSE;
+  alarm_on = TRUE;
+
+  /* search on a copy, the alarm may interrupt it in the middle of a move */
+  COPY_BOARD(root, board);
+  eval_acc_init(root, &root_acc);
 
   /* first iteration */
   top_depth = 1;
-  val = alpha_beta(board, -INFINITY, INFINITY, 1, color);
+  val = alpha_beta(root, &root_acc, -INFINITY, INFINITY, 1, color);
+  done_depth = 1;
+  done_val = color ? val : -val;
 #ifdef DEBUG
   printf("SEARCH: After first iteration, val = %d\n", val);
 #endif
@@ -245,31 +544,9 @@ void mtdf(bitboard *board, struct move *best_move,
     if (val >= INFINITY || val <= -INFINITY)
       break;
 
-    top_depth = i;
-#ifdef DEBUG
-    printf("SEARCH: Searching to depth %d\n", i);
-#endif
-    
-    upper_bound = INFINITY;
-    lower_bound = -INFINITY;
-
-    while (upper_bound > lower_bound) {
-      if (val == lower_bound)
-	beta = val + 1;
-      else 
-	beta = val;
-
-      val = alpha_beta(board, beta - 1, beta, i, color);
-#ifdef DEBUG
-      printf("SEARCH: alpha_beta return, val = %d, beta = %d, [%d, %d]\n", 
-	     val, beta, lower_bound, upper_bound);
-#endif
-      
-      if (val < beta)
-	upper_bound = val;
-      else 
-	lower_bound = val;
-    }
+    val = mtdf_depth(root, &root_acc, i, val, color);
+    done_depth = i;
+    done_val = color ? val : -val;
 
 #ifdef DEBUG
     printf("SEARCH: After %dth iteration, val = %d\n", i, val);
@@ -278,7 +555,56 @@ void mtdf(bitboard *board, struct move *best_move,
 #endif
   }
   alarm(0);
+  alarm_on = FALSE;
+
+  print_stats();
+}
+
+/**
+ * Searches like mtdf(), but within limits instead of with the alarm,
+ * so that it can run in a thread of its own, and without printing.
+ * The first depth is always completed, so best_move is always set
+ * (if color has a move).
+ *
+ * \param limits Time, depth and nodes the search may use (0 for no
+ *        limit) and the flags another thread stops it with
+ */
+void mtdf_limited(bitboard *board, struct move *best_move, const bool color,
+		  const struct search_limits *lim)
+{
+  int i, val;
+  bitboard root[N_BOARDS];
+  struct eval_acc root_acc;
 
-  printf("Completed %d depths, %d nodes, %d evals, %d hash hits (%.02lf eval/sec)\n", 
-	 top_depth - 1, n_nodes, n_evals, n_hash, (double)n_evals/time_allowed);
+  search_init(board, best_move, color);
+  limits = NULL;
+  aborted = FALSE;
+  alarm_on = FALSE;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  clock_on = !lim->ponder;
+
+  COPY_BOARD(root, board);
+  eval_acc_init(root, &root_acc);
+
+  top_depth = 1;
+  val = alpha_beta(root, &root_acc, -INFINITY, INFINITY, 1, color);
+  done_depth = 1;
+  done_val = color ? val : -val;
+  if (lim->info)
+    lim->info(1, val, n_nodes, msecs_used(), best_move);
+
+  limits = lim;
+  for (i = 2; !lim->depth || i <= lim->depth; i++) {
+    if (val >= INFINITY || val <= -INFINITY || check_limits())
+      break;
+
+    val = mtdf_depth(root, &root_acc, i, val, color);
+    if (aborted)
+      break;
+    done_depth = i;
+    done_val = color ? val : -val;
+    if (lim->info)
+      lim->info(i, val, n_nodes, msecs_used(), best_move);
+  }
+  limits = NULL;
 }
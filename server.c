@@ -0,0 +1,383 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "checkers.h"
+
+/*
+ * Game server (./checkers --server socket)
+ *
+ * Hosts many games in one process.  Each connection to the Unix socket
+ * is a game, driven with the commands of the line based protocol (see
+ * protocol.c), and one more:
+ *
+ *   budget <ms>   the time the game has left, 300 s at first
+ *
+ * A go without limits takes a 30th of the budget, and every search
+ * takes what it used, from the go to the answer, off the budget.  One
+ * thread reads all connections.  The searches are queued to a pool of
+ * worker threads, earliest deadline first, and share the transposition
+ * table.  A go ponder or go infinite answers only after ponderhit or
+ * stop, so it gets a thread of its own instead of holding a worker
+ * that timed searches wait for.  The eval caches belong to the
+ * searching threads, so a game that is not searching holds nothing but
+ * its position.
+ */
+
+#define DEFAULT_BUDGET 300000
+#define MIN_READ 1024                   /* the least room a read() gets */
+
+struct client;
+
+/* a search asked for, on a copy of its game */
+struct job {
+  struct session game;
+  struct client *client;
+  long long queued, deadline;           /* milliseconds */
+  bool started;
+  struct job *next;
+};
+
+struct client {
+  int fd;
+  char *buf;                            /* what was read of the next lines */
+  int len, size;
+  struct session game;
+  int budget;                           /* milliseconds */
+  struct job *job;                      /* queued or searching, under lock */
+  bool closed;                          /* freed when its job is done */
+  struct client *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static struct job *queue;
+static struct client *clients;
+
+static long long now_ms()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/* must be called with lock held */
+static void free_client(struct client *c)
+{
+  struct client **p;
+
+  for (p = &clients; *p != c; p = &(*p)->next)
+    ;
+  *p = c->next;
+  fclose(c->game.out);
+  free(c->buf);
+  free(c);
+}
+
+/* searches a started job, answers and frees it */
+static void run_job(struct job *job)
+{
+  struct client *c;
+  long long t;
+
+  /* the time waited in the queue is the game's too */
+  if (job->game.limits.movetime)
+    job->game.limits.movetime = MAX(job->deadline - now_ms(), 1);
+  session_search(&job->game);
+
+  pthread_mutex_lock(&lock);
+  c = job->client;
+  t = now_ms() - job->queued;
+  c->budget = MAX(c->budget - t, 0);
+  c->job = NULL;
+  if (c->closed)
+    free_client(c);
+  pthread_cond_broadcast(&done);
+  pthread_mutex_unlock(&lock);
+  free(job);
+}
+
+static void *worker(void *arg)
+{
+  struct job *job, **p, **first;
+
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    while (queue == NULL)
+      pthread_cond_wait(&work, &lock);
+    for (first = p = &queue; *p; p = &(*p)->next)
+      if ((*p)->deadline < (*first)->deadline)
+	first = p;
+    job = *first;
+    *first = job->next;
+    job->started = TRUE;
+    pthread_mutex_unlock(&lock);
+
+    run_job(job);
+  }
+
+  return NULL;
+}
+
+/* a search that waits for ponderhit or stop, in a thread of its own */
+static void *waiting_search(void *arg)
+{
+  run_job((struct job *)arg);
+  search_free();
+
+  return NULL;
+}
+
+/* drops the game's search if it is only queued, with lock held */
+static void drop_job(struct client *c)
+{
+  struct job **p;
+
+  if (c->job && !c->job->started) {
+    for (p = &queue; *p != c->job; p = &(*p)->next)
+      ;
+    *p = c->job->next;
+    free(c->job);
+    c->job = NULL;
+  }
+}
+
+/*
+ * Ends the game's search before the next: a queued one is dropped, a
+ * running one stopped and waited for, so that it answers first.
+ */
+static void end_job(struct client *c)
+{
+  pthread_mutex_lock(&lock);
+  drop_job(c);
+  if (c->job) {
+    session_tell(&c->job->game, &c->job->game.limits.stop);
+    while (c->job)
+      pthread_cond_wait(&done, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/* queues the search a go asked for */
+static void go(struct client *c, char *args)
+{
+  struct job *job;
+  pthread_attr_t attr;
+  pthread_t id;
+
+  end_job(c);
+  if (!session_go(&c->game, args, MAX(c->budget / 30, 1)))
+    return;
+
+  job = (struct job *)malloc(sizeof(struct job));
+  job->game = c->game;
+  job->client = c;
+  job->started = FALSE;
+  job->queued = now_ms();
+  job->deadline = job->queued +
+    (job->game.limits.movetime ? job->game.limits.movetime : DEFAULT_BUDGET);
+
+  pthread_mutex_lock(&lock);
+  c->job = job;
+  if (job->game.limits.ponder || job->game.infinite) {
+    job->started = TRUE;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&id, &attr, waiting_search, job) != 0) {
+      fprintf(c->game.out, "info string cannot start the search\n");
+      c->job = NULL;
+      free(job);
+    }
+    pthread_attr_destroy(&attr);
+  }
+  else {
+    job->next = queue;
+    queue = job;
+    pthread_cond_signal(&work);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/* tells the game's search to stop or that its pondered move was played */
+static void tell(struct client *c, bool stop)
+{
+  pthread_mutex_lock(&lock);
+  if (c->job)
+    session_tell(&c->job->game, stop ? &c->job->game.limits.stop :
+	      &c->job->game.limits.ponderhit);
+  pthread_mutex_unlock(&lock);
+}
+
+/*
+ * A game is over when its connection is; a queued search is dropped,
+ * a running one stopped.
+ */
+static void close_client(struct client *c)
+{
+  pthread_mutex_lock(&lock);
+  c->closed = TRUE;
+  drop_job(c);
+  if (c->job == NULL)
+    free_client(c);
+  else
+    session_tell(&c->job->game, &c->job->game.limits.stop);
+  pthread_mutex_unlock(&lock);
+}
+
+/* handles a command line, returns FALSE on quit */
+static bool command(struct client *c, char *line)
+{
+  char *args;
+
+  line[strcspn(line, "\r\n")] = 0;
+  args = line + strcspn(line, " \t");
+  args += strspn(args, " \t");
+
+  if (protocol_is(line, "position"))
+    session_position(&c->game, args);
+  else if (protocol_is(line, "go"))
+    go(c, args);
+  else if (protocol_is(line, "stop"))
+    tell(c, TRUE);
+  else if (protocol_is(line, "ponderhit"))
+    tell(c, FALSE);
+  else if (protocol_is(line, "budget"))
+    c->budget = atoi(args);
+  else if (protocol_is(line, "isready"))
+    fprintf(c->game.out, "readyok\n");
+  else if (protocol_is(line, "quit"))
+    return FALSE;
+  else if (line[0])
+    fprintf(c->game.out, "info string unknown command %s\n", line);
+  fflush(c->game.out);
+
+  return TRUE;
+}
+
+/*
+ * Reads what the client sent, returns FALSE when it is gone.  The
+ * buffer grows for lines of any length, a position with many moves may
+ * be long.
+ */
+static bool client_input(struct client *c)
+{
+  char *line, *end;
+  int n;
+
+  if (c->size - c->len < MIN_READ) {
+    c->size = 2 * c->size + MIN_READ;
+    c->buf = (char *)realloc(c->buf, c->size);
+  }
+  if ((n = read(c->fd, c->buf + c->len, c->size - c->len)) <= 0)
+    return FALSE;
+  c->len += n;
+
+  for (line = c->buf;
+       (end = memchr(line, '\n', c->len - (line - c->buf))) != NULL;
+       line = end + 1) {
+    *end = 0;
+    if (!command(c, line))
+      return FALSE;
+  }
+  c->len -= line - c->buf;
+  memmove(c->buf, line, c->len);
+
+  return TRUE;
+}
+
+static void new_client(int fd)
+{
+  struct client *c = (struct client *)calloc(1, sizeof(struct client));
+  char start[] = "startpos";
+
+  c->fd = fd;
+  c->game.out = fdopen(fd, "w");
+  c->budget = DEFAULT_BUDGET;
+  session_position(&c->game, start);
+
+  pthread_mutex_lock(&lock);
+  c->next = clients;
+  clients = c;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Serves games on the Unix socket at path with n_workers searching
+ * threads, until it is killed.
+ *
+ * \return The exit code for main(), if the socket cannot be made
+ */
+int server_loop(const char *path, int n_workers)
+{
+  struct sockaddr_un addr;
+  struct pollfd *fds = NULL;
+  struct client **polled = NULL, *c;
+  pthread_t id;
+  int listener, fd, n, size = 0, i;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket");
+    return 1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 64) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  /* the table is shared, so it is made before anyone searches */
+  search_tables();
+  for (i = 0; i < n_workers; i++)
+    pthread_create(&id, NULL, worker, NULL);
+  fprintf(stderr, "Serving games on %s with %d workers.\n", path, n_workers);
+
+  for (;;) {
+    /* only this thread adds or closes clients, the workers only free them */
+    pthread_mutex_lock(&lock);
+    for (n = 1, c = clients; c; c = c->next)
+      n += !c->closed;
+    if (n > size) {
+      size = 2 * n;
+      fds = (struct pollfd *)realloc(fds, size * sizeof(struct pollfd));
+      polled = (struct client **)realloc(polled, size * sizeof(struct client *));
+    }
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    for (n = 1, c = clients; c; c = c->next)
+      if (!c->closed) {
+	fds[n].fd = c->fd;
+	fds[n].events = POLLIN;
+	polled[n++] = c;
+      }
+    pthread_mutex_unlock(&lock);
+
+    if (poll(fds, n, -1) < 0)
+      continue;
+
+    for (i = 1; i < n; i++)
+      if (fds[i].revents && !client_input(polled[i]))
+	close_client(polled[i]);
+
+    if (fds[0].revents & POLLIN) {
+      if ((fd = accept(listener, NULL, NULL)) >= 0)
+	new_client(fd);
+    }
+  }
+
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include <setjmp.h>
 #include <time.h>
 #include <signal.h>
+#include <unistd.h>
 #include "checkers.h"
 
 jmp_buf env;
@@ -39,11 +40,12 @@ void test_move(char *start_file) {
   struct move move_list[MAX_MOVES];
   bitboard board[N_BOARDS];
   bool color;
+  double time_left;
 
   printf("Testing Move List Generation ... \n");
 
   memset(move_list, 0, MAX_MOVES * sizeof(struct move));
-  if (!read_wdp(board, start_file, &color))
+  if (!read_wdp(board, start_file, &color, &time_left))
     printf("error reading %s\n", start_file);
   else {
     printf("Starting position:\n");
@@ -59,9 +61,10 @@ void test_search(char *start_file, int secs) {
   bitboard board[N_BOARDS];
   char string[128];
   bool color;
+  double time_left;
 
   printf("Testing Search, with time = %d secs... \n", secs);
-  if (!read_wdp(board, start_file, &color))
+  if (!read_wdp(board, start_file, &color, &time_left))
     printf("error reading %s\n", start_file);
   else {
     printf("Starting position:\n");
@@ -84,13 +87,1179 @@ void test_search(char *start_file, int secs) {
   }
 }
 
+/* 
+ * make and unmake every move down to depth, checking the board (and
+ * the move counters and local eval terms) each time
+ */
+int delta_walk(bitboard *board, const struct eval_acc *acc, bool color, int depth)
+{
+  struct delta delta_list[MAX_MOVES];
+  struct eval_acc next_acc;
+  bitboard before[N_BOARDS], cap_kings;
+  int n, i, errors = 0;
+
+  if (depth == 0)
+    return 0;
+
+  n = generate_deltas(board, color, delta_list);
+  if (count_moves(board, color) != n ||
+      has_capture(board, color) != (n > 0 && delta_list[0].captured != 0)) {
+    printf("count_moves()/has_capture() disagree with the %d moves of:\n", n);
+    print_board(board);
+    errors++;
+  }
+
+  for (i = 0; i < n; i++) {
+    COPY_BOARD(before, board);
+    eval_acc_move(acc, board, &delta_list[i], color, &next_acc);
+    cap_kings = make_move(board, &delta_list[i], color);
+
+    if ((board[BLACK] & board[WHITE]) || (board[KING] & ~(board[BLACK] | board[WHITE]))) {
+      printf("move %d-%d gives an inconsistent board:\n", 
+	     delta_list[i].from + 1, delta_list[i].to + 1);
+      print_board(board);
+      errors++;
+    }
+    else if (!eval_acc_check(board, &next_acc)) {
+      printf("move %d-%d leaves the local eval terms out of date:\n", 
+	     delta_list[i].from + 1, delta_list[i].to + 1);
+      print_board(board);
+      errors++;
+    }
+    else
+      errors += delta_walk(board, &next_acc, !color, depth - 1);
+
+    unmake_move(board, &delta_list[i], color, cap_kings);
+    if (board[BLACK] != before[BLACK] || board[WHITE] != before[WHITE] ||
+	board[KING] != before[KING]) {
+      printf("unmaking move %d-%d does not restore the board:\n", 
+	     delta_list[i].from + 1, delta_list[i].to + 1);
+      print_board(before);
+      print_board(board);
+      errors++;
+      COPY_BOARD(board, before);
+    }
+  }
+
+  return errors;
+}
+
+void test_delta(char *start_file, int depth)
+{
+  bool color;
+  bitboard board[N_BOARDS];
+  struct eval_acc acc;
+  double time_left;
+
+  printf("Testing make/unmake to depth %d ... \n", depth);
+  if (!read_wdp(board, start_file, &color, &time_left)) 
+    printf("error reading %s\n", start_file);
+  else {
+    eval_acc_init(board, &acc);
+    printf("%d errors\n", delta_walk(board, &acc, color, depth));
+  }
+}
+
+/* 
+ * Reference for test_capture: the original recursive jump generator,
+ * listing every sequence (duplicates included) into a large buffer.
+ */
+int ref_capture(bitboard *board, bitboard mask, bool color, 
+		struct move *next_move, int room)
+{
+  bitboard to, cap, from, next;
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+  const bitboard move_up = (color ? board[KING] : 0xffffffff) & mask;
+  const bitboard move_down = (!color ? board[KING] : 0xffffffff) & mask;
+  struct move cur_move;
+  int n, i, d, leaves = 0;
+
+  for (d = UP; d <= DOWN; d++) 
+    for (i = 0; i < N_DIRS; i++) {
+      if (d == DOWN)
+	to = DOWN_NEIGHBOR(DOWN_NEIGHBOR(board[(int)color] & move_down, i) & board[(int)!color], i) & empty;
+      else 
+	to = UP_NEIGHBOR(UP_NEIGHBOR(board[(int)color] & move_up, i) & board[(int)!color], i) & empty;
+      while (to && leaves < room) {
+	next = LAST_ONE(to);
+	cap = (d == DOWN) ? UP_NEIGHBOR(next, i) : DOWN_NEIGHBOR(next, i);
+	from = (d == DOWN) ? UP_NEIGHBOR(cap, i) : DOWN_NEIGHBOR(cap, i);
+	to ^= next;
+
+	cur_move.board[(int)color] = (board[(int)color] & ~from) | next;
+	cur_move.board[(int)!color] = board[(int)!color] & ~cap;
+	cur_move.board[KING] = (board[KING] & ~from & ~cap) |
+	  (next & (king_bits[(int)color] | ((board[KING] & from) ? next : 0)));
+
+	if (!(from & board[KING]) && (next & cur_move.board[KING]))
+	  next = 0;
+
+	if ((n = ref_capture(cur_move.board, next, color, next_move + leaves, 
+			     room - leaves)) == 0) {
+	  COPY_BOARD(next_move[leaves].board, cur_move.board);
+	  leaves++;
+	}
+	else
+	  leaves += n;
+      }
+    }
+
+  return leaves;
+}
+
+/* 
+ * compare the capture generator with ref_capture() on one position,
+ * adding the number of duplicate sequences it dropped to *dropped
+ */
+int check_captures(bitboard *board, bool color, int *dropped)
+{
+  struct move move_list[MAX_MOVES], ref_list[1024];
+  int n, n_ref, i, j, errors = 0;
+
+  n = try_capture(board, 0xffffffff, color, move_list);
+  n_ref = ref_capture(board, 0xffffffff, color, ref_list, 1024);
+  *dropped += n_ref - n;
+
+  if (n && count_moves(board, color) != n) {
+    printf("count_moves() gives %d instead of %d captures\n", count_moves(board, color), n);
+    errors++;
+  }
+
+  /* no duplicates, and every result is a reference result */
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < i; j++)
+      if (!memcmp(move_list[i].board, move_list[j].board, sizeof(move_list[i].board)))
+	break;
+    if (j < i) {
+      printf("duplicate capture result:\n");
+      print_board(move_list[i].board);
+      errors++;
+    }
+    for (j = 0; j < n_ref; j++)
+      if (!memcmp(move_list[i].board, ref_list[j].board, sizeof(move_list[i].board)))
+	break;
+    if (j == n_ref) {
+      printf("capture result not found by the reference:\n");
+      print_board(move_list[i].board);
+      errors++;
+    }
+  }
+
+  /* every reference result is listed, unless the list is full */
+  for (j = 0; j < n_ref && n < MAX_MOVES; j++) {
+    for (i = 0; i < n; i++)
+      if (!memcmp(move_list[i].board, ref_list[j].board, sizeof(move_list[i].board)))
+	break;
+    if (i == n) {
+      printf("capture missed:\n");
+      print_board(ref_list[j].board);
+      errors++;
+    }
+  }
+
+  if (errors) {
+    printf("in position, %s to move:\n", color ? "black" : "white");
+    print_board(board);
+  }
+
+  return errors;
+}
+
+/*
+ * Stress test of the capture generator: plays random games from
+ * start_file, and from copies of it with random extra pieces, and
+ * checks the captures in every position reached.
+ */
+void test_capture(char *start_file, int games)
+{
+  bool color, side;
+  bitboard start[N_BOARDS], board[N_BOARDS], sq;
+  struct move move_list[MAX_MOVES];
+  double time_left;
+  int g, ply, n, errors = 0, positions = 0, captures = 0, most = 0, dropped = 0;
+
+  printf("Testing capture generation, %d games ... \n", games);
+  if (!read_wdp(start, start_file, &color, &time_left)) {
+    printf("error reading %s\n", start_file);
+    return;
+  }
+
+  srand(1);
+  for (g = 0; g < games; g++) {
+    COPY_BOARD(board, start);
+    side = color;
+
+    /* all but the first game get a few random pieces added */
+    for (n = g ? rand() % 8 : 0; n > 0; n--) {
+      sq = SQUARE(rand() % BOARD_SIZE);
+      if (sq & (board[BLACK] | board[WHITE]))
+	continue;
+      board[rand() % 2] |= sq;
+      if (rand() % 2)
+	board[KING] |= sq;
+    }
+
+    for (ply = 0; ply < 100; ply++) {
+      positions++;
+      errors += check_captures(board, side, &dropped);
+
+      n = generate_moves(board, side, move_list);
+      if (n == 0)
+	break;
+      if (move_list[0].board[!side] != board[!side]) {
+	captures++;
+	most = MAX(most, n);
+      }
+      n = rand() % n;
+      COPY_BOARD(board, move_list[n].board);
+      side = !side;
+    }
+  }
+
+  printf("%d positions, %d with captures (at most %d), %d duplicates dropped, %d errors\n", 
+	 positions, captures, most, dropped, errors);
+}
+
+/* the boards one ply above the leaves, as a structure of arrays */
+struct frontier {
+  bitboard *black, *white, *king;
+  int n, size;
+};
+
+/*
+ * Counts the leaves of the move tree below board.  The last ply is
+ * only counted with count_moves() - or, if frontier is given, the
+ * boards are stored there to be counted in batches later on.
+ */
+long perft(bitboard *board, bool color, int depth, struct frontier *frontier)
+{
+  struct delta delta_list[MAX_MOVES];
+  bitboard cap_kings;
+  long nodes = 0;
+  int n, i;
+
+  if (depth == 0)
+    return 1;
+
+  if (depth == 1) {
+    if (!frontier)
+      return count_moves(board, color);
+
+    if (frontier->n == frontier->size) {
+      frontier->size = frontier->size ? 2 * frontier->size : 1024;
+      frontier->black = realloc(frontier->black, frontier->size * sizeof(bitboard));
+      frontier->white = realloc(frontier->white, frontier->size * sizeof(bitboard));
+      frontier->king = realloc(frontier->king, frontier->size * sizeof(bitboard));
+    }
+    frontier->black[frontier->n] = board[BLACK];
+    frontier->white[frontier->n] = board[WHITE];
+    frontier->king[frontier->n] = board[KING];
+    frontier->n++;
+    return 0;
+  }
+
+  n = generate_deltas(board, color, delta_list);
+  for (i = 0; i < n; i++) {
+    cap_kings = make_move(board, &delta_list[i], color);
+    nodes += perft(board, !color, depth - 1, frontier);
+    unmake_move(board, &delta_list[i], color, cap_kings);
+  }
+
+  return nodes;
+}
+
+/*
+ * Runs perft one board at a time, then counts the last ply of the same
+ * tree with each batch implementation to show what the lanes gain.
+ */
+void test_perft(char *start_file, int depth)
+{
+  static const char *impls[] = { "scalar", "avx2", "avx512" };
+  struct frontier frontier = { NULL, NULL, NULL, 0, 0 };
+  bool color, side;
+  bitboard board[N_BOARDS];
+  double time_left, secs, scalar_secs = 0;
+  clock_t start;
+  long nodes, batch_nodes = 0;
+  int *counts, i, rep, reps;
+
+  if (!read_wdp(board, start_file, &color, &time_left)) {
+    printf("error reading %s\n", start_file);
+    return;
+  }
+  if (depth < 1)
+    return;
+
+  printf("Perft to depth %d:\n", depth);
+  start = clock();
+  nodes = perft(board, color, depth, NULL);
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("  %-14s %12ld nodes  %7.3lf s  %8.2lf Mnodes/s\n", "single board",
+	 nodes, secs, nodes / secs / 1e6);
+
+  /* collect the frontier once, then time only the counting */
+  perft(board, color, depth, &frontier);
+  side = ((depth - 1) % 2) ? !color : color;
+  counts = malloc(MAX(frontier.n, 1) * sizeof(int));
+  reps = MAX(1, 20000000 / MAX(frontier.n, 1));
+  printf("  %d frontier boards, counted %d times:\n", frontier.n, reps);
+
+  for (i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++) {
+    if (!batch_select(impls[i])) {
+      printf("  batch %-8s not supported on this cpu\n", impls[i]);
+      continue;
+    }
+
+    start = clock();
+    for (rep = 0; rep < reps; rep++)
+      batch_nodes = batch_count_moves(frontier.black, frontier.white, frontier.king,
+				      side, frontier.n, counts);
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (i == 0)
+      scalar_secs = secs;
+
+    printf("  batch %-8s %12ld nodes  %7.3lf s  %8.2lf Mboards/s  (x%.2lf)%s\n",
+	   batch_name(), batch_nodes, secs, (double)frontier.n * reps / secs / 1e6,
+	   scalar_secs / secs, batch_nodes != nodes ? "  MISMATCH" : "");
+  }
+  batch_select(NULL);
+
+  free(counts);
+  free(frontier.black);
+  free(frontier.white);
+  free(frontier.king);
+}
+
+/* 
+ * References for test_evalcmp: the original eval(), threatened(),
+ * runaway() and poss_kills(), which look at the board brick by brick.
+ */
+bitboard ref_threatened(bitboard *board, int8 t_color)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+  
+  bitboard retmask = 0; /* Mask to return */
+  
+  /* Check just bricks of the appropriate color */
+  bitboard to = 0;
+  if (t_color & T_BLACK) to |= board[BLACK];
+  if (t_color & T_WHITE) to |= board[WHITE];
+  
+  bitboard next=0, down=0, up=0;
+  int i=0;
+
+  while (to) {
+    next = LAST_ONE(to);
+    
+    for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
+    
+      /* Determine neighbors */
+      down = DOWN_NEIGHBOR((next&board[BLACK]) | (next&board[WHITE]&board[KING]), i);
+      up = UP_NEIGHBOR((next&board[BLACK]&board[KING]) | (next&board[WHITE]), i);
+      
+      /* A field is considered "threatened" if it is occupied by a hostile
+         brick and the next field into the same direction is empty         */
+      if (((next & board[BLACK] && down & ~board[BLACK]) ||
+           (next & board[WHITE] && down & ~board[WHITE])) &&
+          (DOWN_NEIGHBOR(down, i) & empty))
+        retmask |= down;
+      if (((next & board[BLACK] && up & ~board[BLACK]) ||
+           (next & board[WHITE] && up & ~board[WHITE])) &&
+          (UP_NEIGHBOR(up, i) & empty))
+        retmask |= up;
+    }
+    
+    to ^= next;
+  }
+  
+  return retmask;
+}
+
+/*
+ * The original runaway(): the moves a man on pos needs to become a
+ * king, searched square by square, or -1
+ */
+int ref_runaway(bitboard *board, int pos, bool color)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+
+  /* In this function the variable next is *not* used for the current field */
+
+  bitboard next;     /* Neighboring field */
+  int8 currway=-1,   /* Runaway analysis for the current field */
+       minval=10;    /* Minimum runaway analysis of free neighboring fields */
+  int i=0;
+
+  /* Return 0 if hostile back row is reached */
+  if (pos & king_bits[(int)color]) return 0;
+  
+  for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
+  
+    /* Determine neighbors */
+    if (color == BLACK)
+      next = DOWN_NEIGHBOR(pos, i);
+    else
+      next = UP_NEIGHBOR(pos, i);
+
+    /* Check recursively if field is empty and unthreatened */
+    if (next & empty & ~(ref_threatened(board, T_ENEMY(T_COLOR(color))) & next))
+      currway = ref_runaway(board, next, color);
+
+    /* Determine minimum runaway value if there was a path
+       to the hostile home row found                       */
+    if ((currway > -1) && (currway < minval)) minval = currway;
+  }
+  
+  /* Return minimum value + 1 */
+  if (minval == 10) return -1; else return minval + 1;
+}
+
+/*
+ * The original poss_kills(): how many bricks the brick on pos could
+ * kill in a row, searched recursively
+ */
+int8 ref_poss_kills(bitboard *board, bool color, int8 moves, bitboard pos,
+		    int8 from_v, int8 from_h)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+  
+  /* In this function the variable next is *not* used for the current field */
+  
+  bitboard next,     /* Neighboring field */
+           nextnext; /* Neighbor to a neighboring field into the same dir */
+  bitboard newboard[N_BOARDS];
+  int8 morekills=0,  /* Amount of further kills possible from a position */
+       maxkills=0;   /* Maximum of possible kills from position pos */
+  int i=0;
+  
+  for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
+    
+    /* If the brick can move down and did not come from exact that direction */
+    if ((moves & DOWN) && !((from_v & DOWN) && (from_h & i))) {
+    
+      /* Determine neighboring fields */
+      next = DOWN_NEIGHBOR(pos, i);
+      nextnext = DOWN_NEIGHBOR(DOWN_NEIGHBOR(pos, i), i);
+      
+      /* Call poss_kills recursively if neighbor can be killed */
+      if ((next & board[ENEMY(color)]) && (nextnext & empty)) {
+        newboard[WHITE] = board[WHITE] & ~next & ~pos;
+        newboard[BLACK] = board[BLACK] & ~next & ~pos;
+        newboard[KING] = board[KING] & ~next & ~pos;
+        
+        morekills = ref_poss_kills(newboard, color, moves, nextnext, UP, i);
+        
+        /* The amount of possible kills into one direction is determined by
+           further kills after the first on, or equals otherwise one if the
+           target field is not threatened by an enemy                       */
+        if (morekills > 0) {
+          if (1 + morekills > maxkills) maxkills = 1 + morekills;
+        } else {
+          if (nextnext & ~ref_threatened(newboard, T_ENEMY(T_COLOR(color))))
+            if (1 > maxkills) maxkills = 1;
+        }
+      } 
+    }
+    
+    /* If the brick can move up and did not come from exact that direction */
+    if ((moves & UP) && !((from_v & UP) && (from_h & i))) {
+      
+      /* Determine neighboring fields */
+      next = UP_NEIGHBOR(pos, i);
+      nextnext = UP_NEIGHBOR(UP_NEIGHBOR(pos, i), i);
+      
+      /* Call poss_kills recursively if neighbor can be killed */
+      if ((next & board[ENEMY(color)]) && (nextnext & empty)) {
+        newboard[WHITE] = board[WHITE] & ~next & ~pos;
+        newboard[BLACK] = board[BLACK] & ~next & ~pos;
+        newboard[KING] = board[KING] & ~next & ~pos;
+        
+        morekills = ref_poss_kills(newboard, color, moves, nextnext, DOWN, i);
+        
+        /* The amount of possible kills into one direction is determined by
+           further kills after the first on, or equals otherwise one if the
+           target field is not threatened by an enemy                       */
+        if (morekills > 0) {
+          if (1 + morekills > maxkills) maxkills = 1 + morekills;
+        } else {
+          if (nextnext & ~ref_threatened(newboard, T_ENEMY(T_COLOR(color))))
+            if (1 > maxkills) maxkills = 1;
+        }
+      } 
+    }
+  }
+  
+  return maxkills;
+}
+
+int ref_eval(bitboard *board, bool btm)
+{
+  const bitboard empty = ~(board[WHITE] | board[BLACK]);
+  
+  /* The factors whose sum will be returned */
+  int material_val=0,   /* Material */
+      trapped_val=0,    /* Trapped Kings */
+      doghole_val=0,    /* Dog Holes */
+      safe_val=0,       /* Safe Bricks */
+      runaway_val=0,    /* Runaway Men */
+      turn_val=0,       /* Turn */
+      backrank_val=0,   /* Weak Backrank */
+      kills_val=0;      /* Possible Kills */
+
+  bitboard to = board[BLACK]|board[WHITE];
+  bitboard next=0;      /* mask to the current brick */
+  bool color=0;         /* color of the current brick */
+  int color_bias=0;     /* -1 for white, 1 for black - useful for adding or
+                           subtracting values depending on the brick's color */
+
+	int i=0;							/* loop variable for the detection of next fields */
+	bitboard next_moves;	/* mask to the possible next moves of a king */
+	bitboard up;          /* mask to one upper neighboring field */
+	bitboard down;        /* mask to one lower neighboring field */
+  int8 currway=0;       /* runaway analysis for the current brick */
+  bitboard rest[N_BOARDS];
+
+  #define EXTRA 2
+  int8 curkills=0;      /* possible kills for current brick */
+  int8 moves=0;         /* direction in which current brick can move */
+  int8 kills[4];
+  kills[WHITE]=0;       /* total kill possibilities white bricks have */
+  kills[BLACK]=0;       /* total kill possibilities black bricks have */
+  kills[WHITE+EXTRA]=0; /* max. extra kills white bricks have */
+  kills[BLACK+EXTRA]=0; /* max. extra kills black bricks have */
+
+  /* one loop through all bricks is faster than many loops */
+  while (to) {
+    next = LAST_ONE(to);
+    
+    /* set values according to brick color */
+    if (next & board[BLACK]) {
+      color = BLACK;
+      color_bias = 1;
+      if (next & board[KING])
+        moves = UP + DOWN;
+      else
+        moves = DOWN;
+    } else {
+      color = WHITE;
+      color_bias = -1;
+      if (next & board[KING])
+        moves = UP + DOWN;
+      else
+        moves = UP;
+    }
+
+    /* Possible Kills */
+    curkills = ref_poss_kills(board, color, moves, next, 0, 0);
+    if (curkills > 0) {
+      #ifdef DEBUG_EVAL_DETAILS
+      printf("- Possible kills for field %d: %d\n", fieldnumber(next), curkills);
+      #endif
+      kills[(int)color]++;
+      if (curkills-1 > kills[color + EXTRA]) kills[color + EXTRA] = curkills-1;
+    }
+
+    if (next & board[KING]) {
+
+      /* Material */
+      material_val += color_bias * MAT_KING;
+      
+      /* Trapped Kings */
+      /* Compute a mask with possible next moves for the king first */
+			next_moves = 0;
+			for (i = 0; i < N_DIRS; i++) { /* Check both directions (NW/SE & NE/SW) */
+				/* Compute neighbor possitions */
+				down = DOWN_NEIGHBOR(next, i);
+  			up = UP_NEIGHBOR(next, i);
+      		
+   			/* If the neighboring field is empty or occupied by an enemy
+   				 which can be killed add the appropriate target field      */
+			  if (down & empty) {
+			 		next_moves |= down;
+		 		} else {
+		 		  if ((down & board[ENEMY(color)]) && (DOWN_NEIGHBOR(down, i) & empty))
+		 		  	next_moves |= DOWN_NEIGHBOR(down, i);
+		    }
+			  if (up & empty) {
+			 		next_moves |= up;
+		 		} else {
+		 		  if ((up & board[ENEMY(color)]) && (UP_NEIGHBOR(up, i) & empty))
+		 		  	next_moves |= UP_NEIGHBOR(up, i);
+		    }
+	    }
+         
+      /* In order *not* to be trapped there must exist a possible kill or
+      	 one of the poss. moves is either empty or not enemy-threatened   */
+		  if ((curkills == 0) &&
+          !(next_moves &
+            empty & ~(ref_threatened(board, T_ENEMY(T_COLOR(color))) ) )) {
+  
+          #ifdef DEBUG_EVAL_DETAILS
+          printf("- Trapped king on position %d\n", fieldnumber(next));
+          #endif
+        trapped_val -= color_bias * TRAPPED_KING;
+      }
+
+    } else {
+
+      /* Material */
+      material_val += color_bias * MAT_MAN;
+      
+      /* Safe men on the right or left border are a plus */
+      if (next & 0x18181818) { // Men on pos. 4, 5, 12, 13, 20, 21, 28 or 29
+        #ifdef DEBUG_EVAL_DETAILS
+          printf("- Safe man on position %d\n", fieldnumber(next));
+        #endif
+        safe_val += color_bias * SAFE_MAN;
+      }
+      
+      /* Runaway Checkers */
+      /* The runaway function needs the board without the current man in order
+         to avoid a wrong result in certain situations */
+      rest[BLACK] = board[BLACK] & ~next;
+      rest[WHITE] = board[WHITE] & ~next;
+      rest[KING] = board[KING] & ~next;
+      
+      currway = ref_runaway(rest, next, color);
+      if (currway > -1) {
+        #ifdef DEBUG_EVAL_DETAILS
+        printf("- Man on field %d can become king within %d moves.\n",
+               fieldnumber(next), currway);
+        #endif 
+        runaway_val += color_bias * (RUNAWAY_MAN - currway * RUNAWAY_ROW);
+      }
+
+    }
+
+    to ^= next;
+  }
+  
+  /* Check for victory */
+  if (board[WHITE] == 0) material_val += MAT_VICTORY;
+  if (board[BLACK] == 0) material_val -= MAT_VICTORY;
+
+  /* Whose turn is it? */
+  float kill_fact[2];
+  if (btm) {
+    turn_val += 3;
+    kill_fact[BLACK] = KILL_FACT_TURN;
+    kill_fact[WHITE] = KILL_FACT_NOTURN;
+  } else {
+    turn_val -= 3;
+    kill_fact[BLACK] = KILL_FACT_NOTURN;
+    kill_fact[WHITE] = KILL_FACT_TURN;
+  }
+  
+  /* Compute possible kills values */
+  if ((kills[BLACK] > 0)) {
+    kills_val += kill_fact[BLACK] * POSS_KILL;
+    kills_val += kill_fact[BLACK] * POSS_ALTKILL * (kills[BLACK]-1);
+    kills_val += kill_fact[BLACK] * POSS_EXTRAKILL * kills[BLACK+EXTRA];
+  }
+  if ((kills[WHITE] > 0)) {
+    kills_val -= kill_fact[WHITE] * POSS_KILL;
+    kills_val -= kill_fact[WHITE] * POSS_ALTKILL * (kills[WHITE]-1);
+    kills_val -= kill_fact[WHITE] * POSS_EXTRAKILL * kills[WHITE+EXTRA];
+  }
+
+  /* Check for weak back ranks */
+  int backbricks=0;  
+  to = board[WHITE] & king_bits[BLACK];
+  while (to) {
+    next = LAST_ONE(to);
+    backbricks++;
+    to ^= next;
+  }
+  switch(backbricks) {
+  case 0:
+    backrank_val += BACK_0;
+    break;
+  case 1:
+    backrank_val += BACK_1;
+    break;
+  case 2:
+    backrank_val += BACK_2;
+    break;
+  case 3:
+    backrank_val += BACK_3;
+    break;
+  }
+  backbricks=0;
+  to = board[BLACK] & king_bits[WHITE];
+  while (to) {
+    next = LAST_ONE(to);
+    backbricks++;
+    to ^= next;
+  }
+  switch(backbricks) {
+  case 0:
+    backrank_val -= BACK_0;
+    break;
+  case 1:
+    backrank_val -= BACK_1;
+    break;
+  case 2:
+    backrank_val -= BACK_2;
+    break;
+  case 3:
+    backrank_val -= BACK_3;
+    break;
+  }
+  
+  /* Dog Holes */
+  if ((board[WHITE] & 0x00000010) && (board[BLACK] & 0x00000001)) {
+    // White men on pos. 5 and black brick on pos. 1
+    #ifdef DEBUG_EVAL_DETAILS
+    printf("- White man in dog hole.\n");
+    #endif
+    doghole_val += DOG_HOLE;
+  } 
+  if ((board[BLACK] & 0x08000000) && (board[WHITE] & 0x80000000)) {
+    // Black men on pos. 28 and white brick on pos. 31
+    #ifdef DEBUG_EVAL_DETAILS
+    printf("- Black man in dog hole.\n");
+    #endif
+    doghole_val -= DOG_HOLE;
+  }
+  
+  /* Output the parameters */
+  #ifdef DEBUG_EVAL
+  printf("Material: %d\n", material_val);
+  printf("Trapped Kings: %d\n", trapped_val);
+  printf("Dog holes: %d\n", doghole_val);
+  printf("Safe men: %d\n", safe_val);
+  printf("Runaway Checkers: %d\n", runaway_val);
+  printf("Current Turn: %d\n", turn_val);
+  printf("Back Rank: %d\n", backrank_val);
+  printf("Possible Kills: %d (B: %d poss., max. %d; W: %d poss., max. %d)\n",
+         kills_val, kills[BLACK], kills[BLACK+EXTRA]+1, kills[WHITE], kills[WHITE+EXTRA]+1);
+  #endif
+
+  return material_val + trapped_val + doghole_val + safe_val + runaway_val +
+         turn_val + backrank_val + kills_val;
+}
+
+/* positions to run the eval over, with the side to move in each */
+struct corpus {
+  bitboard (*board)[N_BOARDS];
+  bool *btm;
+  int n, size;
+};
+
+/*
+ * Collects the positions of random games from start_file, and from
+ * copies of it with random extra pieces, as test_capture() plays them.
+ */
+void collect_corpus(char *start_file, int games, struct corpus *corpus)
+{
+  bool color, side;
+  bitboard start[N_BOARDS], board[N_BOARDS], sq;
+  struct move move_list[MAX_MOVES];
+  double time_left;
+  int g, ply, n;
+
+  if (!read_wdp(start, start_file, &color, &time_left)) {
+    printf("error reading %s\n", start_file);
+    return;
+  }
+
+  srand(1);
+  for (g = 0; g < games; g++) {
+    COPY_BOARD(board, start);
+    side = color;
+
+    for (n = g ? rand() % 8 : 0; n > 0; n--) {
+      sq = SQUARE(rand() % BOARD_SIZE);
+      if (sq & (board[BLACK] | board[WHITE]))
+	continue;
+      board[rand() % 2] |= sq;
+      if (rand() % 2)
+	board[KING] |= sq;
+    }
+
+    for (ply = 0; ply < 100; ply++) {
+      if (corpus->n == corpus->size) {
+	corpus->size = corpus->size ? 2 * corpus->size : 1024;
+	corpus->board = realloc(corpus->board, corpus->size * sizeof(*corpus->board));
+	corpus->btm = realloc(corpus->btm, corpus->size * sizeof(bool));
+      }
+      COPY_BOARD(corpus->board[corpus->n], board);
+      corpus->btm[corpus->n] = side;
+      corpus->n++;
+
+      n = generate_moves(board, side, move_list);
+      if (n == 0)
+	break;
+      n = rand() % n;
+      COPY_BOARD(board, move_list[n].board);
+      side = !side;
+    }
+  }
+}
+
+/* the fields of x with the board turned by 180 degrees */
+bitboard turn_around(bitboard x)
+{
+  bitboard y = 0;
+  int i;
+
+  for (i = 0; i < BOARD_SIZE; i++)
+    if (x & SQUARE(i))
+      y |= SQUARE(BOARD_SIZE - 1 - i);
+
+  return y;
+}
+
+/*
+ * Checks that eval() and threatened() give the same results as the
+ * references on the positions of random games from start_file, then
+ * measures evals per second of both.
+ */
+void test_evalcmp(char *start_file, int games)
+{
+  struct corpus corpus = { NULL, NULL, 0, 0 };
+  int i, rep, reps, errors = 0, val, ref_val;
+  bitboard *b, rot[N_BOARDS];
+  int8 t;
+  clock_t start;
+  double secs, ref_secs;
+  volatile int sink = 0;
+
+  printf("Comparing eval with the reference, %d games ... \n", games);
+  collect_corpus(start_file, games, &corpus);
+  if (corpus.n == 0)
+    return;
+
+  for (i = 0; i < corpus.n; i++) {
+    for (t = T_WHITE; t <= T_BOTH; t++)
+      if (threatened(corpus.board[i], t) != ref_threatened(corpus.board[i], t)) {
+	printf("threatened(%d) gives %08x instead of %08x in:\n", t,
+	       threatened(corpus.board[i], t), ref_threatened(corpus.board[i], t));
+	print_board(corpus.board[i]);
+	errors++;
+      }
+
+    /* kings-only endgames have their own eval, which must be the same
+       for both colors with the board turned around                   */
+    b = corpus.board[i];
+    if (b[KING] == (b[BLACK] | b[WHITE])) {
+      rot[BLACK] = turn_around(b[WHITE]);
+      rot[WHITE] = turn_around(b[BLACK]);
+      rot[KING] = turn_around(b[KING]);
+      val = eval(b, corpus.btm[i]);
+      if (eval(rot, !corpus.btm[i]) != -val) {
+	printf("eval gives %d, turned around %d, %s to move, in:\n", val,
+	       eval(rot, !corpus.btm[i]), corpus.btm[i] ? "black" : "white");
+	print_board(b);
+	errors++;
+      }
+      continue;
+    }
+
+    val = eval(corpus.board[i], corpus.btm[i]);
+    ref_val = ref_eval(corpus.board[i], corpus.btm[i]);
+    if (val != ref_val) {
+      printf("eval gives %d instead of %d, %s to move, in:\n", val, ref_val,
+	     corpus.btm[i] ? "black" : "white");
+      print_board(corpus.board[i]);
+      errors++;
+    }
+  }
+  printf("%d positions, %d errors\n", corpus.n, errors);
+
+  reps = MAX(1, 200000 / corpus.n);
+
+  start = clock();
+  for (rep = 0; rep < reps; rep++)
+    for (i = 0; i < corpus.n; i++)
+      sink += ref_eval(corpus.board[i], corpus.btm[i]);
+  ref_secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  for (rep = 0; rep < reps; rep++)
+    for (i = 0; i < corpus.n; i++)
+      sink += eval(corpus.board[i], corpus.btm[i]);
+  secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("  reference  %10.0lf evals/sec\n", (double)corpus.n * reps / ref_secs);
+  printf("  eval       %10.0lf evals/sec  (x%.2lf)\n", (double)corpus.n * reps / secs,
+	 ref_secs / secs);
+
+  free(corpus.board);
+  free(corpus.btm);
+}
+
+/*
+ * The default n-tuple tables hold the local terms of eval(), so with
+ * them ntuple_eval() must give these terms and the turn, in every
+ * implementation and after a round trip through a table file
+ */
+void test_ntuple(char *start_file, int games)
+{
+  const int back_rank[5] = { BACK_0, BACK_1, BACK_2, BACK_3, 0 };
+  const char *impls[] = { "scalar", "bmi2", "avx2" };
+  char file[] = "/tmp/ntuple_testXXXXXX";
+  struct corpus corpus = { NULL, NULL, 0, 0 };
+  struct eval_acc acc;
+  int i, k, rep, reps, errors = 0, val, local, fd;
+  bitboard *b;
+  clock_t start;
+  double secs, eval_secs;
+  volatile int sink = 0;
+
+  printf("Testing the n-tuple evaluator, %d games ... \n", games);
+  collect_corpus(start_file, games, &corpus);
+  if (corpus.n == 0)
+    return;
+
+  ntuple_load(NULL);
+  if ((fd = mkstemp(file)) < 0 || close(fd) < 0 ||
+      !ntuple_save(file) || !ntuple_load(file)) {
+    printf("round trip through %s failed\n", file);
+    errors++;
+  }
+  remove(file);
+
+  for (k = 0; k < 3; k++) {
+    if (!ntuple_select(impls[k])) {
+      printf("  %-8s not supported here\n", impls[k]);
+      continue;
+    }
+
+    for (i = 0; i < corpus.n; i++) {
+      b = corpus.board[i];
+      eval_acc_init(b, &acc);
+      local = acc.material + acc.safe + acc.doghole +
+	back_rank[BIT_COUNT(b[WHITE] & king_bits[BLACK])] -
+	back_rank[BIT_COUNT(b[BLACK] & king_bits[WHITE])] +
+	(corpus.btm[i] ? BLACK_TO_MOVE : -BLACK_TO_MOVE);
+      if (!b[WHITE])
+	local = MAT_VICTORY;
+      if (!b[BLACK])
+	local = -MAT_VICTORY;
+
+      val = ntuple_eval(b, corpus.btm[i]);
+      if (val != local) {
+	printf("%s gives %d instead of %d, %s to move, in:\n", impls[k], val, local,
+	       corpus.btm[i] ? "black" : "white");
+	print_board(b);
+	errors++;
+      }
+    }
+  }
+  printf("%d positions, %d errors\n", corpus.n, errors);
+
+  reps = MAX(1, 200000 / corpus.n);
+
+  start = clock();
+  for (rep = 0; rep < reps; rep++)
+    for (i = 0; i < corpus.n; i++)
+      sink += eval(corpus.board[i], corpus.btm[i]);
+  eval_secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("  eval     %10.0lf evals/sec\n", (double)corpus.n * reps / eval_secs);
+
+  for (k = 0; k < 3; k++) {
+    if (!ntuple_select(impls[k]))
+      continue;
+
+    start = clock();
+    for (rep = 0; rep < reps; rep++)
+      for (i = 0; i < corpus.n; i++)
+	sink += ntuple_eval(corpus.board[i], corpus.btm[i]);
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("  %-8s %10.0lf evals/sec  (x%.2lf)\n", impls[k],
+	   (double)corpus.n * reps / secs, eval_secs / secs);
+  }
+  ntuple_select(NULL);
+
+  free(corpus.board);
+  free(corpus.btm);
+}
+
+/* the kernels test_bench() times, each called once per position */
+static int bench_generate_moves(bitboard *board, bool btm)
+{
+  struct move move_list[MAX_MOVES];
+
+  return generate_moves(board, btm, move_list);
+}
+
+static int bench_try_capture(bitboard *board, bool btm)
+{
+  struct move move_list[MAX_MOVES];
+
+  return try_capture(board, 0xffffffff, btm, move_list);
+}
+
+static int bench_eval(bitboard *board, bool btm)
+{
+  return eval(board, btm);
+}
+
+static int bench_threatened(bitboard *board, bool btm)
+{
+  return threatened(board, T_BOTH);
+}
+
+static int bench_runaway(bitboard *board, bool btm)
+{
+  bitboard runners[2][MAX_RUNAWAY + 1];
+
+  return runaway_black(board, runners[BLACK]) ^ runaway_white(board, runners[WHITE]);
+}
+
+static int bench_hash_key(bitboard *board, bool btm)
+{
+  return HASH_KEY(board);
+}
+
+/* a probe, then a store of what it found with a bound changed */
+static int bench_trans(bitboard *board, bool btm)
+{
+  struct hash_pos entry;
+  int hash_key = HASH_KEY(board) % TRANS_TABLE_SIZE;
+
+  if (!trans_probe(board, btm, hash_key, &entry)) {
+    memset(&entry, 0, sizeof(entry));
+    COPY_BOARD(entry.board, board);
+    entry.color = btm;
+  }
+  entry.low_depth++;
+  trans_store(hash_key, &entry);
+
+  return entry.low_depth;
+}
+
+static const struct {
+  const char *name;
+  int (*kernel)(bitboard *board, bool btm);
+} bench_kernels[] = {
+  { "generate_moves", bench_generate_moves },
+  { "try_capture", bench_try_capture },
+  { "eval", bench_eval },
+  { "threatened", bench_threatened },
+  { "runaway", bench_runaway },
+  { "HASH_KEY", bench_hash_key },
+  { "trans_probe_store", bench_trans },
+};
+
+#define N_BENCH_KERNELS (sizeof(bench_kernels) / sizeof(bench_kernels[0]))
+#define BENCH_RUNS 21
+#define BENCH_RUN_NS 20e6           /* the least time of a run */
+
+static double bench_ns()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* the p-th percentile of the sorted times of the runs */
+static double percentile(const double *ns, int p)
+{
+  return ns[(p * (BENCH_RUNS - 1) + 50) / 100];
+}
+
+/* the median of kernel name in a file test_bench() wrote, 0 if none */
+static double baseline_median(const char *file, const char *name)
+{
+  char line[256], key[64];
+  double median = 0;
+  FILE *fd;
+
+  if ((fd = fopen(file, "r")) == NULL)
+    return 0;
+  snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+  while (fgets(line, sizeof(line), fd))
+    if (strstr(line, key) && strstr(line, "\"median_ns\": "))
+      median = atof(strstr(line, "\"median_ns\": ") + 13);
+  fclose(fd);
+
+  return median;
+}
+
+/*
+ * Times each kernel over the positions of random games from start_file,
+ * in nanoseconds a call.  After a warm-up pass each kernel has
+ * BENCH_RUNS runs of at least BENCH_RUN_NS, and their median and
+ * percentiles are printed as JSON.  With a baseline, a file printed
+ * earlier, the medians are compared on stderr; a change is marked when
+ * the baseline is outside the 10th to 90th percentile of this run.
+ */
+void test_bench(char *start_file, int games, char *baseline)
+{
+  struct corpus corpus = { NULL, NULL, 0, 0 };
+  double ns[BENCH_RUNS], medians[N_BENCH_KERNELS], start, pass, old;
+  int k, run, rep, reps, i, sum = 0;
+  volatile int sink = 0;
+
+  collect_corpus(start_file, games, &corpus);
+  if (corpus.n == 0)
+    return;
+  search_tables();
+
+  printf("{\n  \"corpus\": \"%s\",\n  \"games\": %d,\n  \"positions\": %d,\n"
+	 "  \"runs\": %d,\n  \"kernels\": [\n", start_file, games, corpus.n,
+	 BENCH_RUNS);
+  for (k = 0; k < N_BENCH_KERNELS; k++) {
+    /* the warm-up pass also tells how many passes make a run */
+    start = bench_ns();
+    for (i = 0; i < corpus.n; i++)
+      sum += bench_kernels[k].kernel(corpus.board[i], corpus.btm[i]);
+    pass = bench_ns() - start;
+    reps = MAX(1, (int)(BENCH_RUN_NS / MAX(pass, 1)));
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+      start = bench_ns();
+      for (rep = 0; rep < reps; rep++)
+	for (i = 0; i < corpus.n; i++)
+	  sum += bench_kernels[k].kernel(corpus.board[i], corpus.btm[i]);
+      ns[run] = (bench_ns() - start) / ((double)reps * corpus.n);
+    }
+    qsort(ns, BENCH_RUNS, sizeof(double), compare_doubles);
+    medians[k] = percentile(ns, 50);
+
+    printf("    {\"name\": \"%s\", \"median_ns\": %.3lf, \"p10_ns\": %.3lf, "
+	   "\"p90_ns\": %.3lf, \"min_ns\": %.3lf, \"max_ns\": %.3lf}%s\n",
+	   bench_kernels[k].name, medians[k], percentile(ns, 10),
+	   percentile(ns, 90), ns[0], ns[BENCH_RUNS - 1],
+	   k < N_BENCH_KERNELS - 1 ? "," : "");
+
+    if (baseline) {
+      if (k == 0)
+	fprintf(stderr, "%-18s %10s %10s %8s\n", "kernel", "ns", "baseline", "change");
+      if ((old = baseline_median(baseline, bench_kernels[k].name)) > 0)
+	fprintf(stderr, "%-18s %10.3lf %10.3lf %+7.1lf%%%s\n", bench_kernels[k].name,
+		medians[k], old, 100 * (medians[k] - old) / old,
+		old < percentile(ns, 10) || old > percentile(ns, 90) ? " *" : "");
+      else
+	fprintf(stderr, "%-18s %10.3lf %10s\n", bench_kernels[k].name, medians[k], "-");
+    }
+  }
+  printf("  ]\n}\n");
+  sink += sum;
+
+  free(corpus.board);
+  free(corpus.btm);
+}
+
 void test_trans(char *start_file, char *move)
 {
   bool color;
   bitboard board[N_BOARDS];
+  double time_left;
   struct move opp_move;
 
-  if (!read_wdp(board, start_file, &color)) 
+  if (!read_wdp(board, start_file, &color, &time_left)) 
     printf("error reading %s\n", start_file);
   else {
     printf("Starting position:\n");
@@ -109,8 +1278,9 @@ void test_eval(char *start_file)
 {
   bool color;
   bitboard board[N_BOARDS];
+  double time_left;
 
-  if (!read_wdp(board, start_file, &color)) 
+  if (!read_wdp(board, start_file, &color, &time_left)) 
     printf("error reading %s\n", start_file);
   else {
     printf("Starting position:\n");
@@ -141,6 +1311,18 @@ int main(int argc, char *argv[]) {
     test_search(argv[2], atoi(argv[3]));
   else if (!strcmp(argv[1], "-trans"))
     test_trans(argv[2], argv[3]);
+  else if (!strcmp(argv[1], "-delta"))
+    test_delta(argv[2], atoi(argv[3]));
+  else if (!strcmp(argv[1], "-capture"))
+    test_capture(argv[2], atoi(argv[3]));
+  else if (!strcmp(argv[1], "-perft"))
+    test_perft(argv[2], atoi(argv[3]));
+  else if (!strcmp(argv[1], "-evalcmp"))
+    test_evalcmp(argv[2], atoi(argv[3]));
+  else if (!strcmp(argv[1], "-ntuple"))
+    test_ntuple(argv[2], atoi(argv[3]));
+  else if (!strcmp(argv[1], "-bench"))
+    test_bench(argv[2], atoi(argv[3]), argc > 4 ? argv[4] : NULL);
 
   return 0;
 }
@@ -1,31 +1,294 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include "checkers.h"
 
+/* the time stamp counter on x86, elsewhere the clock in nanoseconds */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS() __rdtsc()
+#define TICK_UNIT "cycles"
+#else
+static unsigned long long TICKS(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+#define TICK_UNIT "ns"
+#endif
 
+/*
+ * Shows the terms of eval() for one position, or with -b measures what
+ * eval() and its expensive parts cost over a corpus of positions and
+ * how much each term changes the score.  The corpus is the positions in
+ * the board files given and those of random games played from them.
+ */
 
 /* function prototypes */
 bitboard possible_moves(bitboard *board); // Returns possible moves for a field
 void print_numbers();        // Prints out the field numbers for orientation
 
+/* positions to benchmark, with the side to move in each */
+static bitboard (*boards)[N_BOARDS];
+static bool *btms;
+static int n_boards, size;
 
-int main(int argc, char *argv[])
+static void add_board(bitboard *board, bool btm)
 {
-  printf("here we go...\n");
+  if (n_boards == size) {
+    size = size ? 2 * size : 1024;
+    boards = realloc(boards, size * sizeof(*boards));
+    btms = realloc(btms, size * sizeof(bool));
+  }
+  COPY_BOARD(boards[n_boards], board);
+  btms[n_boards] = btm;
+  n_boards++;
+}
+
+/*
+ * adds the position in file and those of games random games from it,
+ * or all positions of a .pos file
+ */
+static bool read_corpus(char *file, int games)
+{
+  bitboard start[N_BOARDS], board[N_BOARDS];
+  struct move move_list[MAX_MOVES];
+  struct pos_file pf;
+  bool color, side;
+  double time_left;
+  int g, ply, n, len = strlen(file);
+
+  if (len > 4 && !strcmp(file + len - 4, ".pos")) {
+    if (!pos_open(file, &pf))
+      return FALSE;
+    for (n = 0; n < pf.n; n++) {
+      COPY_BOARD(board, pf.rec[n].board);
+      add_board(board, pf.rec[n].btm);
+    }
+    pos_close(&pf);
+    return TRUE;
+  }
+
+  if (!read_wdp(start, file, &color, &time_left)) {
+    printf("error reading %s\n", file);
+    return FALSE;
+  }
+  add_board(start, color);
+
+  for (g = 0; g < games; g++) {
+    COPY_BOARD(board, start);
+    side = color;
+
+    for (ply = 0; ply < 100; ply++) {
+      n = generate_moves(board, side, move_list);
+      if (n == 0)
+	break;
+      n = rand() % n;
+      COPY_BOARD(board, move_list[n].board);
+      side = !side;
+      add_board(board, side);
+    }
+  }
+
+  return TRUE;
+}
+
+/* the functions timed, each called as if from eval() */
+static int time_none(bitboard *board, bool btm)
+{
+  return 0;
+}
+
+static int time_eval(bitboard *board, bool btm)
+{
+  return eval(board, btm);
+}
+
+static int time_threatened(bitboard *board, bool btm)
+{
+  return threatened(board, T_BOTH);
+}
+
+static int time_runaway(bitboard *board, bool btm)
+{
+  bitboard runners[MAX_RUNAWAY + 1];
+
+  return runaway_black(board, runners) ^ runaway_white(board, runners);
+}
+
+static int time_kills(bitboard *board, bool btm)
+{
+  int longest[2];
+
+  return kills_black(board, &longest[BLACK]) ^ kills_white(board, &longest[WHITE]) ^
+    longest[BLACK] ^ longest[WHITE];
+}
+
+static const struct {
+  char *name;
+  int (*fn)(bitboard *board, bool btm);
+} timed[] = {
+  { "(call)", time_none },
+  { "eval", time_eval },
+  { "threatened", time_threatened },
+  { "runaway", time_runaway },
+  { "kills", time_kills },
+};
+#define N_TIMED (int)(sizeof(timed) / sizeof(timed[0]))
 
-  int val;
-  bitboard b[N_BOARDS]; 
+/*
+ * Cycles (ns off x86) per call of each timed function, the fastest of passes passes
+ * over the corpus as well as the mean.  The (call) line is the cost of
+ * the call and the loop alone.  Returns the fastest for eval().
+ */
+static double bench_cycles(int passes)
+{
+  unsigned long long start, cycles, best, total;
+  double eval_best = 0;
+  volatile int sink = 0;
+  int f, pass, i;
+
+  printf("%-12s %10s %10s\n", "function", "best", "mean");
+  for (f = 0; f < N_TIMED; f++) {
+    best = ~0ULL;
+    total = 0;
+    for (pass = 0; pass < passes; pass++) {
+      start = TICKS();
+      for (i = 0; i < n_boards; i++)
+	sink += timed[f].fn(boards[i], btms[i]);
+      cycles = TICKS() - start;
+      best = MIN(best, cycles);
+      total += cycles;
+    }
+    printf("%-12s %10.1f %10.1f " TICK_UNIT "/call\n", timed[f].name,
+	   (double)best / n_boards, (double)total / passes / n_boards);
+    if (f == 1)
+      eval_best = (double)best / n_boards;
+  }
+
+  return eval_best;
+}
+
+/*
+ * For each term, how often it is not zero, its mean and largest size,
+ * and how often the score changes sign without it.  Finished games are
+ * left out, their material swamps everything else.
+ */
+static void term_impact(void)
+{
+  int terms[N_TERMS], nonzero[N_TERMS] = {0}, largest[N_TERMS] = {0},
+    flips[N_TERMS] = {0};
+  double sum[N_TERMS] = {0};
+  int i, t, val, n = 0;
+
+  for (i = 0; i < n_boards; i++) {
+    if (!boards[i][WHITE] || !boards[i][BLACK])
+      continue;
+    n++;
+    val = eval_terms(boards[i], btms[i], terms);
+    for (t = 0; t < N_TERMS; t++) {
+      if (terms[t] == 0)
+	continue;
+      nonzero[t]++;
+      sum[t] += abs(terms[t]);
+      largest[t] = MAX(largest[t], abs(terms[t]));
+      if ((val > 0) - (val < 0) != (val > terms[t]) - (val < terms[t]))
+	flips[t]++;
+    }
+  }
+  if (n == 0)
+    return;
+
+  printf("\n%-18s %8s %10s %8s %8s\n", "term", "nonzero", "mean |val|", "largest", "sign");
+  for (t = 0; t < N_TERMS; t++)
+    printf("%-18s %7.1f%% %10.1f %8d %7.1f%%\n", term_names[t],
+	   100.0 * nonzero[t] / n, sum[t] / n, largest[t], 100.0 * flips[t] / n);
+}
+
+static void usage(void)
+{
+  printf("Usage: ./testeval [board-file]\n");
+  printf("       ./testeval -b [-g games] [-p passes] [-m max-cycles] board-files...\n");
+  printf("          board-files are .wdp files or .pos files (see wdp2pos)\n");
+  printf("          -b  Benchmark eval() and its terms\n");
+  printf("          -g  Random games played from each file (100)\n");
+  printf("          -p  Passes over the positions per function (20)\n");
+  printf("          -m  Fail if eval() takes more cycles per call (ns\n");
+  printf("              off x86, where there is no cycle counter)\n");
+}
+
+static int bench(int argc, char *argv[])
+{
+  int c, games = 100, passes = 20;
+  double max_cycles = 0, cycles;
+
+  while ((c = getopt(argc, argv, "bg:p:m:")) != -1)
+    switch (c) {
+    case 'b':
+      break;
+    case 'g':
+      games = atoi(optarg);
+      break;
+    case 'p':
+      passes = MAX(atoi(optarg), 1);
+      break;
+    case 'm':
+      max_cycles = atof(optarg);
+      break;
+    default:
+      usage();
+      return 1;
+    }
+
+  if (optind == argc) {
+    usage();
+    return 1;
+  }
+
+  srand(1);
+  for (; optind < argc; optind++)
+    if (!read_corpus(argv[optind], games))
+      return 1;
+  printf("%d positions\n\n", n_boards);
+
+  cycles = bench_cycles(passes);
+  term_impact();
+
+  if (max_cycles > 0 && cycles > max_cycles) {
+    printf("\neval() takes %.1f " TICK_UNIT " per call, more than %.1f\n",
+	   cycles, max_cycles);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int val, t;
+  int terms[N_TERMS];
+  bitboard b[N_BOARDS];
   char *filename = "starts/testeval.wdp";
   bool color=WHITE;
-  bool *colorp;
-  colorp = &color;
- 
+  double time_left;
+
+  if (argc > 1 && argv[1][0] == '-')
+    return bench(argc, argv);
+
+  printf("here we go...\n");
+
   if (argc>1)
-    read_wdp(b, argv[1], colorp);
-  else 
-    read_wdp(b, filename, colorp);
- 
-val = eval(b, color);
+    filename = argv[1];
+  if (!read_wdp(b, filename, &color, &time_left))
+    return 1;
+
+  val = eval_terms(b, color, terms);
+  for (t = 0; t < N_TERMS; t++)
+    printf("%s: %d\n", term_names[t], terms[t]);
   printf("\nTotal evaluation: %d\n\n", val);
 
   printf("\nCurrent board:\n");
@@ -47,6 +310,8 @@ val = eval(b, color);
   x[WHITE] = possible_moves(b);
   x[BLACK] = 0;
   print_board(x);
+
+  return 0;
 }
 
 
@@ -0,0 +1,392 @@
+/* tuner for the eval() weights */
+
+/*
+ * Fits the weights to the results of games (Texel's method): the result
+ * a position predicts is the logistic of its eval() value, and the
+ * weights are changed one step at a time for as long as that lowers the
+ * logistic loss over all positions.  The loss is summed over the
+ * positions in parallel, one slice per thread.
+ *
+ * Positions are read one per line: the 32 fields as in a .wdp file
+ * (b, w, B, W or .), the color to move (b or w) and the result of the
+ * game for black (1, 0.5 or 0).  A .pos file (see wdp2pos) is mapped
+ * into memory instead and its positions with a result are used.  The
+ * weights found are printed in the format read_weights() reads.
+ *
+ * With -n the n-tuple tables (see ntuple.c) are fitted to the same loss
+ * instead, by stochastic gradient descent, and written to a file that
+ * ./checkers --eval=ntuple:file loads.
+ *
+ * Built with -DTUNABLE, see the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#undef INFINITY         /* math.h has one too, checkers.h wins */
+#include "checkers.h"
+
+#define MAX_THREADS 64
+
+/* the part of the samples one thread sums the loss over */
+struct slice {
+  int from, to;
+  double loss;
+};
+
+static struct pos_record *parsed;
+static const struct pos_record *samples;
+static int n_samples, n_used, n_threads;
+static double scale = 100;      /* eval() difference for a factor e in the odds */
+static bool fit_tuples;         /* the loss of ntuple_eval() instead of eval() */
+
+/* parses a sample line, returns FALSE if it is not one */
+static bool parse_sample(char *line, struct pos_record *s)
+{
+  char *p, *end;
+  bool color;
+  double result;
+
+  if ((p = parse_position(line, s->board, &color)) == NULL)
+    return FALSE;
+  s->btm = color;
+
+  result = strtod(p, &end);
+  s->labels = POS_RESULT;
+  s->result = (int16)(result * 1000 + 0.5);
+  return end != p && result >= 0 && result <= 1;
+}
+
+/* finished games and positions without a result tell nothing */
+static bool useful(const struct pos_record *s)
+{
+  return (s->labels & POS_RESULT) && s->board[WHITE] && s->board[BLACK];
+}
+
+static bool read_samples(char *file)
+{
+  struct pos_file pf;
+  char line[256];
+  int size = 0, n = 0, i, len = strlen(file);
+  FILE *fd;
+
+  /* a binary file is used where it is mapped */
+  if (len > 4 && !strcmp(file + len - 4, ".pos")) {
+    if (!pos_open(file, &pf))
+      return FALSE;
+    samples = pf.rec;
+    n_samples = pf.n;
+    for (i = 0; i < n_samples; i++)
+      n_used += useful(&samples[i]);
+    return n_used > 0;
+  }
+
+  fd = strcmp(file, "-") ? fopen(file, "r") : stdin;
+  if (fd == NULL) {
+    perror(file);
+    return FALSE;
+  }
+
+  while (fgets(line, sizeof(line), fd)) {
+    n++;
+    if (n_samples == size) {
+      size = size ? 2 * size : 65536;
+      parsed = (struct pos_record *)realloc(parsed, size * sizeof(struct pos_record));
+    }
+    if (!parse_sample(line, &parsed[n_samples])) {
+      fprintf(stderr, "%s:%d: bad position line: %s", file, n, line);
+      continue;
+    }
+
+    if (useful(&parsed[n_samples]))
+      n_samples++;
+  }
+
+  if (fd != stdin)
+    fclose(fd);
+
+  samples = parsed;
+  n_used = n_samples;
+
+  return n_used > 0;
+}
+
+static void *slice_loss(void *arg)
+{
+  struct slice *slice = (struct slice *)arg;
+  bitboard board[N_BOARDS];
+  double p, result, loss = 0;
+  int i;
+
+  for (i = slice->from; i < slice->to; i++) {
+    if (!useful(&samples[i]))
+      continue;
+    COPY_BOARD(board, samples[i].board);
+    result = samples[i].result / 1000.0;
+    p = 1 / (1 + exp(-(fit_tuples ? ntuple_eval(board, samples[i].btm) :
+		       eval(board, samples[i].btm)) / scale));
+    p = MIN(MAX(p, 1e-12), 1 - 1e-12);
+    loss -= result * log(p) + (1 - result) * log(1 - p);
+  }
+  slice->loss = loss;
+
+  return NULL;
+}
+
+/* the mean logistic loss over all samples with the current weights */
+static double loss(void)
+{
+  pthread_t thread[MAX_THREADS];
+  struct slice slice[MAX_THREADS];
+  double sum = 0;
+  int i;
+
+  for (i = 0; i < n_threads; i++) {
+    slice[i].from = (long)n_samples * i / n_threads;
+    slice[i].to = (long)n_samples * (i + 1) / n_threads;
+    if (i > 0)
+      pthread_create(&thread[i], NULL, slice_loss, &slice[i]);
+  }
+  slice_loss(&slice[0]);
+
+  for (i = 0; i < n_threads; i++) {
+    if (i > 0)
+      pthread_join(thread[i], NULL);
+    sum += slice[i].loss;
+  }
+
+  return sum / n_used;
+}
+
+/* picks the scale that fits the current weights best, by ternary search */
+static void fit_scale(void)
+{
+  double lo = log(1), hi = log(10000), a, b, la, lb;
+  int i;
+
+  for (i = 0; i < 40; i++) {
+    a = lo + (hi - lo) / 3;
+    b = hi - (hi - lo) / 3;
+    scale = exp(a);
+    la = loss();
+    scale = exp(b);
+    lb = loss();
+    if (la < lb)
+      hi = b;
+    else
+      lo = a;
+  }
+  scale = exp((lo + hi) / 2);
+}
+
+/*
+ * Changes each weight by one step up or down while that lowers the loss,
+ * until a pass over all weights does not.  Integer weights start with
+ * steps of step, halved down to 1; the kill factors move by the least
+ * amount KILL_FIX() tells apart.
+ */
+static double tune(int step, int max_passes)
+{
+  const struct weight_name *w;
+  double best, next, d_step = 1.0 / (1 << KILL_FACT_BITS);
+  int pass, dir, i_old = 0;
+  double d_old = 0;
+  bool improved;
+
+  best = loss();
+  fprintf(stderr, "%d positions, %d threads, scale %.1f, loss %.6f\n",
+	  n_used, n_threads, scale, best);
+
+  for (pass = 1; pass <= max_passes; pass++) {
+    improved = FALSE;
+
+    for (w = weight_names; w->name; w++)
+      for (dir = 1; dir >= -1; dir -= 2) {
+	if (w->i) {
+	  i_old = *w->i;
+	  *w->i += dir * step;
+	}
+	else {
+	  d_old = *w->d;
+	  *w->d += dir * d_step;
+	}
+
+	if (weights_valid() && (next = loss()) < best) {
+	  best = next;
+	  improved = TRUE;
+	  break;
+	}
+
+	if (w->i)
+	  *w->i = i_old;
+	else
+	  *w->d = d_old;
+      }
+
+    fprintf(stderr, "pass %d, step %d: loss %.6f\n", pass, step, best);
+
+    if (!improved) {
+      if (step == 1)
+	break;
+      step /= 2;
+    }
+  }
+
+  return best;
+}
+
+/*
+ * Fits the n-tuple tables: in each epoch the positions, in a new random
+ * order, move the weights they index and the tempo weight by rate times
+ * how far off their prediction is, the gradient of the loss.  The
+ * weights are kept as floats meanwhile and rounded into the tables after
+ * each epoch.
+ */
+static double fit_ntuple(int epochs, double rate)
+{
+  bitboard board[N_BOARDS];
+  int16 *w;
+  int *tempo, *order, idx[NTUPLE_MAX], size, n, i, j, k, t, epoch;
+  float *fw, ft;
+  double v, d, best;
+
+  w = ntuple_weights(&size, &tempo);
+  fw = (float *)malloc(size * sizeof(float));
+  order = (int *)malloc(n_samples * sizeof(int));
+  for (i = 0; i < size; i++)
+    fw[i] = w[i];
+  ft = *tempo;
+  for (i = n = 0; i < n_samples; i++)
+    if (useful(&samples[i]))
+      order[n++] = i;
+
+  best = loss();
+  fprintf(stderr, "%d positions, %d weights, scale %.1f, loss %.6f\n",
+	  n, size, scale, best);
+
+  srand(1);
+  for (epoch = 1; epoch <= epochs; epoch++) {
+    for (i = n - 1; i > 0; i--) {
+      j = rand() % (i + 1);
+      k = order[i];
+      order[i] = order[j];
+      order[j] = k;
+    }
+
+    for (i = 0; i < n; i++) {
+      COPY_BOARD(board, samples[order[i]].board);
+      k = ntuple_index(board, idx);
+      v = samples[order[i]].btm ? ft : -ft;
+      for (t = 0; t < k; t++)
+	v += fw[idx[t]];
+
+      d = rate * (samples[order[i]].result / 1000.0 - 1 / (1 + exp(-v / scale)));
+      for (t = 0; t < k; t++)
+	fw[idx[t]] += d;
+      ft += samples[order[i]].btm ? d : -d;
+    }
+
+    for (i = 0; i < size; i++)
+      w[i] = (int16)MIN(MAX(lrintf(fw[i]), -32767), 32767);
+    *tempo = lrintf(ft);
+    best = loss();
+    fprintf(stderr, "epoch %d: loss %.6f\n", epoch, best);
+  }
+
+  free(fw);
+  free(order);
+
+  return best;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ./tune [-j threads] [-w weights-file] [-s step] [-p passes] positions-file\n");
+  fprintf(stderr, "          -j  Threads to sum the loss with (all cores)\n");
+  fprintf(stderr, "          -w  Weights to start from (the compiled-in ones)\n");
+  fprintf(stderr, "          -s  First step for integer weights (1)\n");
+  fprintf(stderr, "          -p  Most passes over the weights (1000)\n");
+  fprintf(stderr, "       ./tune -n tables-file [-j threads] [-t tables-file] [-e epochs] [-r rate]\n");
+  fprintf(stderr, "              positions-file\n");
+  fprintf(stderr, "          -n  Fit the n-tuple tables instead and write them to tables-file\n");
+  fprintf(stderr, "          -t  Tables to start from (the default ones)\n");
+  fprintf(stderr, "          -e  Epochs, passes over the positions (20)\n");
+  fprintf(stderr, "          -r  Change of a weight for a prediction off by 1 (2)\n");
+  fprintf(stderr, "       positions-file may be - for standard input, or a .pos file.\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int c, step = 1, passes = 1000, epochs = 20;
+  char *tables_out = NULL, *tables_in = NULL;
+  double rate = 2;
+
+  n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((c = getopt(argc, argv, "j:w:s:p:n:t:e:r:")) != -1)
+    switch (c) {
+    case 'j':
+      n_threads = atoi(optarg);
+      break;
+    case 'w':
+      if (!read_weights(optarg))
+	return 1;
+      break;
+    case 's':
+      step = atoi(optarg);
+      break;
+    case 'p':
+      passes = atoi(optarg);
+      break;
+    case 'n':
+      tables_out = optarg;
+      break;
+    case 't':
+      tables_in = optarg;
+      break;
+    case 'e':
+      epochs = atoi(optarg);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    default:
+      usage();
+      return 1;
+    }
+
+  if (optind != argc - 1) {
+    usage();
+    return 1;
+  }
+  n_threads = MIN(MAX(n_threads, 1), MAX_THREADS);
+  step = MAX(step, 1);
+
+  if (!read_samples(argv[optind])) {
+    fprintf(stderr, "%s: no positions\n", argv[optind]);
+    return 1;
+  }
+
+  if (tables_out) {
+    if (!ntuple_load(tables_in))
+      return 1;
+    /* before the threads of slice_loss(), ntuple_eval() would choose it in each */
+    ntuple_select(NULL);
+    fit_tuples = TRUE;
+    fit_scale();
+    fit_ntuple(epochs, rate);
+    if (!ntuple_save(tables_out))
+      return 1;
+    fprintf(stderr, "n-tuple tables written to %s\n", tables_out);
+    return 0;
+  }
+
+  fit_scale();
+  tune(step, passes);
+  print_weights();
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+/* converter to the binary position format */
+
+/*
+ * Writes positions to a binary position file (see struct pos_record),
+ * which batch tools map into memory instead of parsing text.  A .wdp
+ * file gives one position; any other file gives one per line, written
+ * as the positions tune reads: the 32 fields as in a .wdp file, the
+ * color to move and optionally the result of the game for black (1,
+ * 0.5 or 0) and a score.  With -l a binary file is listed in that
+ * format instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checkers.h"
+
+/* converts one text file, returns the number of positions or -1 */
+static int convert(FILE *out, char *file)
+{
+  struct pos_record rec;
+  char line[256], *p, *end;
+  bool color;
+  double val, time_left;
+  int n = 0, line_no = 0, len = strlen(file);
+  FILE *fd;
+
+  memset(&rec, 0, sizeof(rec));
+
+  if (len > 4 && !strcmp(file + len - 4, ".wdp")) {
+    if (!read_wdp(rec.board, file, &color, &time_left))
+      return -1;
+    rec.btm = color;
+    return pos_write(out, &rec) ? 1 : -1;
+  }
+
+  fd = strcmp(file, "-") ? fopen(file, "r") : stdin;
+  if (fd == NULL) {
+    perror(file);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fd)) {
+    line_no++;
+    if ((p = parse_position(line, rec.board, &color)) == NULL) {
+      fprintf(stderr, "%s:%d: bad position line: %s", file, line_no, line);
+      continue;
+    }
+    rec.btm = color;
+    rec.labels = 0;
+
+    val = strtod(p, &end);
+    if (end != p && val >= 0 && val <= 1) {
+      rec.labels |= POS_RESULT;
+      rec.result = (int16)(val * 1000 + 0.5);
+      p = end;
+      val = strtod(p, &end);
+      if (end != p) {
+	rec.labels |= POS_SCORE;
+	rec.score = (int)val;
+      }
+    }
+
+    if (!pos_write(out, &rec)) {
+      perror("write");
+      n = -1;
+      break;
+    }
+    n++;
+  }
+
+  if (fd != stdin)
+    fclose(fd);
+
+  return n;
+}
+
+/* lists a binary file as text, in the format convert() reads */
+static bool list(char *file)
+{
+  struct pos_file pf;
+  const struct pos_record *rec;
+  int i, j;
+
+  if (!pos_open(file, &pf))
+    return FALSE;
+
+  for (i = 0; i < pf.n; i++) {
+    rec = &pf.rec[i];
+    for (j = 0; j < BOARD_SIZE; j++)
+      printf("%c%s", rec->board[BLACK] & SQUARE(j) ? (rec->board[KING] & SQUARE(j) ? 'B' : 'b') :
+	     (rec->board[WHITE] & SQUARE(j) ? (rec->board[KING] & SQUARE(j) ? 'W' : 'w') : '.'),
+	     j % 4 == 3 ? " " : "");
+    printf("%c", rec->btm ? 'b' : 'w');
+    if (rec->labels & POS_RESULT)
+      printf(" %g", rec->result / 1000.0);
+    if (rec->labels & POS_SCORE)
+      printf(" %d", rec->score);
+    printf("\n");
+  }
+
+  pos_close(&pf);
+
+  return TRUE;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ./wdp2pos out-file files...\n");
+  fprintf(stderr, "       ./wdp2pos -l pos-file\n");
+  fprintf(stderr, "          -l  List a binary position file as text\n");
+  fprintf(stderr, "       A file other than a .wdp file has a position per line;\n");
+  fprintf(stderr, "       it may be - for standard input.\n");
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *out;
+  int i, n, total = 0;
+
+  if (argc == 3 && !strcmp(argv[1], "-l"))
+    return list(argv[2]) ? 0 : 1;
+
+  if (argc < 3 || argv[1][0] == '-') {
+    usage();
+    return 1;
+  }
+
+  if ((out = pos_create(argv[1])) == NULL)
+    return 1;
+
+  for (i = 2; i < argc; i++) {
+    if ((n = convert(out, argv[i])) < 0) {
+      fclose(out);
+      return 1;
+    }
+    total += n;
+  }
+
+  if (fclose(out) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  fprintf(stderr, "%d positions written to %s\n", total, argv[1]);
+
+  return 0;
+}